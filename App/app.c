@@ -7,12 +7,15 @@
 #include "rtc.h"
 #include "stm32_lpm_if.h"
 
+// The main task's stack
+STATIC StackType_t mainTaskStack[STACKWORDS(TASKSTACK_MAIN)];
+
 // Initialize the app
 void appInit()
 {
 
     // Create the main task
-    xTaskCreate(mainTask, TASKNAME_MAIN, STACKWORDS(TASKSTACK_MAIN), NULL, TASKPRI_MAIN, NULL);
+    taskCreate(TASKID_MAIN, mainTask, TASKNAME_MAIN, TASKLETTER_MAIN, TASKPRI_MAIN, mainTaskStack, sizeof(mainTaskStack));
 
 }
 
@@ -33,10 +36,10 @@ void appISR(uint16_t GPIO_Pin)
 #endif
 
     // USB Detect processing, noting that the signal is ACTIVE HIGH
-    // We just wake up any task that might be interested in the change
+    // We just wake up the tasks that are interested in the change
 #ifdef USB_DETECT_Pin
     if ((GPIO_Pin & USB_DETECT_Pin) != 0) {
-        taskGiveAllFromISR();
+        taskSignalFromISR(TASK_EVENT_USB_CHANGE);
     }
 #endif
 
@@ -92,6 +95,9 @@ void appPostSleepProcessing(uint32_t ulExpectedIdleTime)
     // the timer faster than it's actually supposed to go.
     if (sleepBeganMs != 0) {
         int64_t elapsedMs = MX_RTC_GetMs() - sleepBeganMs;
+        if (elapsedMs > 0) {
+            cpuSleptMs((uint32_t) elapsedMs);
+        }
         if (elapsedMs > 1) {
             vTaskStepTick(pdMS_TO_TICKS(elapsedMs-1));
             MX_StepTickMs(elapsedMs);
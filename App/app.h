@@ -4,6 +4,7 @@
 
 #include "main.h"
 #include "mutex.h"
+#include "job.h"
 #include "product.h"
 
 #pragma once
@@ -26,10 +27,29 @@
 #define TASKSTACK_REQ               2500
 #define TASKPRI_REQ                 ( configMAX_PRIORITIES - 2 )        // Normal
 
-#define TASKID_NUM_TASKS            2           // Total
+#define TASKID_LOG                  2           // Debug output
+#define TASKNAME_LOG                "log"
+#define TASKLETTER_LOG              'L'
+#define TASKSTACK_LOG               1000
+#define TASKPRI_LOG                 ( tskIDLE_PRIORITY + 1 )            // lowest
+
+#define TASKID_JOB                  3           // Run-to-completion jobs
+#define TASKNAME_JOB                "job"
+#define TASKLETTER_JOB              'J'
+#define TASKSTACK_JOB               1000
+#define TASKPRI_JOB                 ( configMAX_PRIORITIES - 2 )        // Normal
+
+#define TASKID_NUM_TASKS            4           // Total, which sizes the task registry
 #define TASKID_UNKNOWN              0xFFFF
 #define STACKWORDS(x)               ((x) / sizeof(StackType_t))
 
+// Per-port arenas from which request processing may allocate, released after each request
+#define SERIAL_ARENA_USB            2048
+#define SERIAL_ARENA_LPUART1        2048
+#define SERIAL_ARENA_USART1         1024
+#define SERIAL_ARENA_USART2         1024
+#define SERIAL_REQUEST_RESERVE      128         // Room for a typical request, reserved up front
+
 // serial.c
 bool serialIsActive(void);
 void serialInit(uint32_t serialTaskID);
@@ -38,9 +58,18 @@ bool serialIsDebugPort(UART_HandleTypeDef *huart);
 bool serialSetDebugPort(UART_HandleTypeDef *huart);
 bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataLen, bool *retDiagAllowed);
 void serialUnlock(UART_HandleTypeDef *huart, bool reset);
+memArena *serialArena(UART_HandleTypeDef *huart);
 void serialOutputString(UART_HandleTypeDef *huart, char *buf);
 void serialOutput(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
 void serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
+void serialDebugOutput(uint8_t *buf, uint32_t buflen);
+
+// logtask.c
+#define LOG_RING_BYTES      2048            // must be a power of two
+void logTask(void *params);
+void logOutput(uint8_t *buf, uint32_t buflen);
+void logFlush(void);
+void logStats(void);
 
 // maintask.c
 void mainTask(void *params);
@@ -58,13 +87,32 @@ bool ledIsEnabled(void);
 #define rdtRestart          1
 #define rdtBootloader       2
 void reqTask(void *params);
-void reqButtonPressedISR(void);
 
 // req.c
-err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed);
+err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed, memArena *arena);
+void reqArenaStats(void);
 
 // diag.c
-err_t diagProcess(char *diagCommand);
+// Diagnostic commands
+typedef enum {
+    CMD_RESTART,
+    CMD_POWER,
+    CMD_MEM,
+    CMD_BOOTLOADER_DIRECT,
+    CMD_TRACE,
+    CMD_T,
+    CMD_POST,
+    CMD_VERSION,
+    CMD_PROF,
+    CMD_TOP,
+    CMD_KTRACE,
+    CMD_LOCKS,
+    CMD_ISR,
+    CMD_UNRECOGNIZED
+} allCommands;
+err_t diagProcess(char *diagCommand, memArena *arena);
+int getCommand(char *cmd, int cmdLen);
+const char *getCommandName(int cmd);
 
 // Errors
 #define ERR_IO "{io}"
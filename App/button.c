@@ -7,6 +7,15 @@
 // Debounce
 STATIC int64_t lastPressedMs = 0;
 
+// The LED blink that acknowledges a press, run as a job that reposts itself for each step
+#define BUTTON_BLINK_STEPS  4
+#define BUTTON_BLINK_MS     100
+STATIC uint32_t buttonBlinkStep = 0;
+void buttonBlink(void *arg);
+STATIC job buttonBlinkJob = JOB_INIT(buttonBlink, NULL, JOB_PRI_NORMAL);
+void buttonPressed(void *arg);
+STATIC job buttonPressedJob = JOB_INIT(buttonPressed, NULL, JOB_PRI_NORMAL);
+
 // The button was pressed.  Note that this is an ISR and that it must be de-bounced
 void buttonPressISR(bool pressed)
 {
@@ -24,6 +33,26 @@ void buttonPressISR(bool pressed)
     }
 
     // Process button press outside of ISR level
-    reqButtonPressedISR();
+    jobPostFromISR(&buttonPressedJob);
+
+}
 
+// Give positive indication that we're still alive, unless we already are
+void buttonPressed(void *arg)
+{
+    if (buttonBlinkStep == 0) {
+        buttonBlink(NULL);
+    }
+}
+
+// Take the next step of the blink, alternating the LED on and off
+void buttonBlink(void *arg)
+{
+    ledEnable((buttonBlinkStep & 1) == 0);
+    buttonBlinkStep++;
+    if (buttonBlinkStep < BUTTON_BLINK_STEPS) {
+        jobPostDelayed(&buttonBlinkJob, BUTTON_BLINK_MS);
+    } else {
+        buttonBlinkStep = 0;
+    }
 }
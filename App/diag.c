@@ -6,22 +6,6 @@
 #include "usart.h"
 #include "post.h"
 
-// Maximum command
-#define maxCMD 256
-
-// Commands
-typedef enum {
-    CMD_RESTART,
-    CMD_POWER,
-    CMD_MEM,
-    CMD_BOOTLOADER_DIRECT,
-    CMD_TRACE,
-    CMD_T,
-    CMD_POST,
-    CMD_VERSION,
-    CMD_UNRECOGNIZED
-} allCommands;
-
 typedef struct {
     char *cmd;
     int ID;
@@ -36,16 +20,20 @@ STATIC const cmd_def cmdText[] = {
     {"bootloader", CMD_BOOTLOADER_DIRECT},
     {"post", CMD_POST},
     {"version", CMD_VERSION},
+    {"prof", CMD_PROF},
+    {"top", CMD_TOP},
+    {"ktrace", CMD_KTRACE},
+    {"locks", CMD_LOCKS},
+    {"isr", CMD_ISR},
     {NULL, 0},
 };
 
 // Forwards
 int asciiEQLCI(char *x, char* y);
 int asciiEQLCIDelim(char *x, char* y, int yLen);
-int getCommand(char *cmd, int cmdLen);
 
-// Process a diagnostic command
-err_t diagProcess(char *diagCommand)
+// Process a diagnostic command, allocating its temporaries from the request's arena
+err_t diagProcess(char *diagCommand, memArena *arena)
 {
     err_t err = errNone;
 
@@ -57,13 +45,20 @@ err_t diagProcess(char *diagCommand)
     int cmd = getCommand(diagCommand, diagCommandLen);
 
     // If it looks like an AT command, do special processing.  Else, copy
-    // to a local buffer, cleaning and null-terminated for string processing
-    char argbuf[maxCMD];
-    int j = 0;
-    for (int i=0; i<diagCommandLen; i++) {
-        if (j >= sizeof(argbuf)-1) {
-            break;
+    // to a buffer, cleaning and null-terminated for string processing
+    array *args;
+    err = arrayAllocArena(arena, 0, NULL, &args);
+    if (!err) {
+        err = arrayReserve(args, diagCommandLen+1);
+        if (err) {
+            arrayFree(args);
         }
+    }
+    if (err) {
+        MX_DBG_Enable(debugWasEnabled);
+        return err;
+    }
+    for (int i=0; i<diagCommandLen; i++) {
         bool goodChar = false;
         if (isAsciiAlphaNumeric(diagCommand[i])) {
             goodChar = true;
@@ -72,14 +67,11 @@ err_t diagProcess(char *diagCommand)
             goodChar = true;
         }
         if (goodChar) {
-            argbuf[j++] = diagCommand[i];
+            arrayAppendBytes(args, &diagCommand[i], 1);
         }
     }
-    argbuf[j] = '\0';
-
-    // Retain the argbuf before we write nulls into it
-    char cmdline[maxCMD];
-    strLcpy(cmdline, argbuf);
+    arrayAppendStringTerminate(args);
+    char *argbuf = arrayAddress(args);
 
     // Break into an argv list
     char *argv[6];
@@ -137,6 +129,8 @@ err_t diagProcess(char *diagCommand)
         debugf("RAM at startup: %lu\n", heapFreeAtStartup);
         debugf("RAM       free: %lu\n", xPortGetFreeHeapSize());
         taskStackStats();
+        reqArenaStats();
+        logStats();
         break;
     }
 
@@ -144,6 +138,7 @@ err_t diagProcess(char *diagCommand)
         char buf[100];
         MX_ActivePeripherals(buf, sizeof(buf));
         debugf("POWER: %s\n", buf);
+        taskWakeupStats();
         break;
     }
 
@@ -159,7 +154,75 @@ err_t diagProcess(char *diagCommand)
         if (streql(argv[1], "off")) {
             debugWasEnabled = false;
         }
-        debugf("trace is %s\n", debugWasEnabled ? "on" : "off");
+        if (streql(argv[1], "binary")) {
+            debugWasEnabled = true;
+            debugBinary(true);
+        }
+        if (streql(argv[1], "text")) {
+            debugBinary(false);
+        }
+        if (debugModuleByName(argv[1]) != 0) {
+            // With no level, everything is enabled for the module
+            int level = DEBUG_LEVEL_TRACE;
+            if (argv[2][0] != '\0') {
+                err = debugLevelByName(argv[2], &level);
+            }
+            if (!err) {
+                debugWasEnabled = true;
+                debugSetModuleLevel(debugModuleByName(argv[1]), level);
+            }
+        }
+        debugf("trace is %s (%s)\n", debugWasEnabled ? "on" : "off", debugIsBinary() ? "binary" : "text");
+        debugModuleLevels();
+        break;
+
+    case CMD_PROF:
+        if (streql(argv[1], "mutex")) {
+            mutexBenchmark();
+            break;
+        }
+        if (streql(argv[1], "reset")) {
+            profReset();
+            debugf("profiling statistics reset\n");
+            break;
+        }
+        profStats();
+        break;
+
+    case CMD_TOP:
+        cpuTop();
+        break;
+
+    case CMD_KTRACE:
+        if (streql(argv[1], "on") || streql(argv[1], "off")) {
+            ktraceEnable(streql(argv[1], "on"));
+            debugf("kernel trace is %s\n", argv[1]);
+            break;
+        }
+        if (streql(argv[1], "clear")) {
+            ktraceClear();
+            debugf("kernel trace cleared\n");
+            break;
+        }
+        ktraceDump();
+        break;
+
+    case CMD_LOCKS:
+        if (streql(argv[1], "reset")) {
+            mutexStatsReset();
+            debugf("mutex statistics reset\n");
+            break;
+        }
+        mutexStats();
+        break;
+
+    case CMD_ISR:
+        if (streql(argv[1], "reset")) {
+            MX_ISR_StatsReset();
+            debugf("isr statistics reset\n");
+            break;
+        }
+        MX_ISR_Stats();
         break;
 
     case CMD_RESTART:
@@ -189,6 +252,7 @@ err_t diagProcess(char *diagCommand)
 
     // Restore debug output
     MX_DBG_Enable(debugWasEnabled);
+    arrayFree(args);
 
     // Done
     return errNone;
@@ -231,3 +295,14 @@ int getCommand(char *cmd, int cmdLen)
     }
     return CMD_UNRECOGNIZED;
 }
+
+// Get the name of a recognized command
+const char *getCommandName(int cmd)
+{
+    for (int i=0; cmdText[i].cmd != NULL; i++) {
+        if (cmdText[i].ID == cmd) {
+            return cmdText[i].cmd;
+        }
+    }
+    return "unknown";
+}
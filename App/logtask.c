@@ -0,0 +1,194 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include <stdatomic.h>
+
+// Debug output is appended to this ring by any task or ISR without blocking, and is drained to the
+// debug port by the lowest-priority task.  Each record is a commit byte, a 16-bit length, and the
+// data.  Producers reserve space by advancing the head atomically, fill in the record, and then set
+// its commit byte; the consumer stops at the first record that isn't yet committed, and zeroes the
+// space that it consumes so that stale data is never mistaken for a commit.
+#define LOG_RECORD_HEADER   3
+STATIC uint8_t logRing[LOG_RING_BYTES];
+STATIC atomic_uint logHead = 0;
+STATIC atomic_uint logTail = 0;
+STATIC atomic_uint logDropped = 0;
+STATIC atomic_uint logDroppedBytes = 0;
+STATIC atomic_flag logDraining = ATOMIC_FLAG_INIT;
+STATIC bool logTaskActive = false;
+
+// Forwards
+bool logDrain(void);
+
+// Log task
+void logTask(void *params)
+{
+
+    // Init task
+    logTaskActive = true;
+
+    // Drain the ring whenever there's something in it
+    while (true) {
+        if (!logDrain()) {
+            taskTakeSlack(TASKID_LOG, ms1Hour, TASK_IDLE_SLACK_MS);
+        }
+    }
+
+}
+
+// Copy bytes into the ring, wrapping as necessary
+static void logRingWrite(uint32_t pos, const uint8_t *data, uint32_t len)
+{
+    uint32_t offset = pos % LOG_RING_BYTES;
+    uint32_t first = GMIN(len, LOG_RING_BYTES - offset);
+    memcpy(&logRing[offset], data, first);
+    memcpy(logRing, &data[first], len - first);
+}
+
+// Copy bytes out of the ring, wrapping as necessary, and zero the space that they occupied
+static void logRingRead(uint32_t pos, uint8_t *data, uint32_t len)
+{
+    uint32_t offset = pos % LOG_RING_BYTES;
+    uint32_t first = GMIN(len, LOG_RING_BYTES - offset);
+    if (data != NULL) {
+        memcpy(data, &logRing[offset], first);
+        memcpy(&data[first], logRing, len - first);
+    }
+    memset(&logRing[offset], 0, first);
+    memset(logRing, 0, len - first);
+}
+
+// Append debug output to the ring, dropping it if there's no room.  This never blocks, and may
+// be called from an ISR.  Until the log task is running, output is written synchronously.
+void logOutput(uint8_t *buf, uint32_t buflen)
+{
+
+    // Before the log task starts there's nothing to drain the ring
+    if (!logTaskActive && !MX_InISR()) {
+        serialDebugOutput(buf, buflen);
+        return;
+    }
+
+    // Reserve space for the record
+    if (buflen > 0xffff) {
+        buflen = 0xffff;
+    }
+    uint32_t need = LOG_RECORD_HEADER + buflen;
+    unsigned head = atomic_load(&logHead);
+    do {
+        if ((head + need) - atomic_load(&logTail) > LOG_RING_BYTES) {
+            atomic_fetch_add(&logDropped, 1);
+            atomic_fetch_add(&logDroppedBytes, buflen);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak(&logHead, &head, head + need));
+
+    // Fill in the record, committing it last
+    uint8_t len[2] = {(uint8_t) buflen, (uint8_t) (buflen >> 8)};
+    logRingWrite(head+1, len, sizeof(len));
+    logRingWrite(head+LOG_RECORD_HEADER, buf, buflen);
+    atomic_thread_fence(memory_order_release);
+    logRing[head % LOG_RING_BYTES] = 1;
+
+    // Wake the log task
+    if (MX_InISR()) {
+        taskGiveFromISR(TASKID_LOG);
+    } else {
+        taskGive(TASKID_LOG);
+    }
+
+}
+
+// Drain committed records from the ring to the debug port, batching them into a single write
+// where possible.  Space is released only once the records in it have been written, so that
+// logFlush() can't return while output is still held in the local buffer.  Returns true if
+// anything was output.
+bool logDrain(void)
+{
+    uint8_t buf[128];
+    uint32_t buflen = 0;
+    bool didSomething = false;
+
+    // There may only be a single consumer at a time
+    if (atomic_flag_test_and_set(&logDraining)) {
+        return false;
+    }
+
+    unsigned pos = atomic_load(&logTail);
+    unsigned consumed = pos;
+    while (true) {
+        if (pos == atomic_load(&logHead) || logRing[pos % LOG_RING_BYTES] == 0) {
+            break;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        uint8_t len[2];
+        logRingRead(pos, NULL, 1);
+        logRingRead(pos+1, len, sizeof(len));
+        uint32_t recordLen = len[0] | (len[1] << 8);
+        pos += LOG_RECORD_HEADER;
+
+        // Output in chunks through the local buffer, releasing the records that have been
+        // written in full
+        while (recordLen > 0) {
+            uint32_t chunk = GMIN(recordLen, sizeof(buf) - buflen);
+            logRingRead(pos, &buf[buflen], chunk);
+            buflen += chunk;
+            pos += chunk;
+            recordLen -= chunk;
+            if (buflen == sizeof(buf)) {
+                serialDebugOutput(buf, buflen);
+                buflen = 0;
+                atomic_store(&logTail, (recordLen == 0) ? pos : consumed);
+            }
+        }
+        consumed = pos;
+        didSomething = true;
+
+    }
+
+    if (buflen > 0) {
+        serialDebugOutput(buf, buflen);
+    }
+    atomic_store(&logTail, consumed);
+
+    atomic_flag_clear(&logDraining);
+    return didSomething;
+}
+
+// Synchronously write anything pending in the ring, so that output that follows it on the debug
+// port isn't reordered.  This does nothing in an ISR.  If another consumer is draining or a producer
+// hasn't yet committed its record, wait briefly for it.  Where the caller can't block, such as
+// on the way to a panic with interrupts masked, whatever can be drained is written directly and
+// nothing is waited for.
+void logFlush(void)
+{
+    if (MX_InISR()) {
+        return;
+    }
+    if (!taskCanBlock()) {
+        while (logDrain()) {
+        }
+        return;
+    }
+    int64_t beganMs = timerMs();
+    while (atomic_load(&logTail) != atomic_load(&logHead)) {
+        if (!logDrain()) {
+            if (timerMsElapsed(beganMs, 500)) {
+                break;
+            }
+            timerMsSleep(1);
+        }
+    }
+}
+
+// Display log statistics
+void logStats(void)
+{
+    unsigned head = atomic_load(&logHead);
+    unsigned tail = atomic_load(&logTail);
+    debugR("log: %lu of %lu bytes pending, %lu messages (%lu bytes) dropped\n",
+           (unsigned long) (head - tail), (unsigned long) LOG_RING_BYTES,
+           (unsigned long) atomic_load(&logDropped), (unsigned long) atomic_load(&logDroppedBytes));
+}
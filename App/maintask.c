@@ -10,13 +10,15 @@
 #include "rtc.h"
 #include "utilities_def.h"
 
+// Stacks of the tasks that the main task creates
+STATIC StackType_t reqTaskStack[STACKWORDS(TASKSTACK_REQ)];
+STATIC StackType_t logTaskStack[STACKWORDS(TASKSTACK_LOG)];
+STATIC StackType_t jobTaskStack[STACKWORDS(TASKSTACK_JOB)];
+
 // Main task
 void mainTask(void *params)
 {
 
-    // Init task
-    taskRegister(TASKID_MAIN, TASKNAME_MAIN, TASKLETTER_MAIN, TASKSTACK_MAIN);
-
     // Init low power manager
     UTIL_LPM_Init();
     UTIL_LPM_SetOffMode((1 << CFG_LPM_APPLI_Id), UTIL_LPM_DISABLE);
@@ -56,12 +58,19 @@ void mainTask(void *params)
     // Signal that we've started, but do it here so we don't block request processing
     ledRestartSignal();
 
+    // Create the task that runs jobs posted by ISRs and other tasks
+    taskCreate(TASKID_JOB, jobTask, TASKNAME_JOB, TASKLETTER_JOB, TASKPRI_JOB, jobTaskStack, sizeof(jobTaskStack));
+
     // Create the serial request processing task
-    xTaskCreate(reqTask, TASKNAME_REQ, STACKWORDS(TASKSTACK_REQ), NULL, TASKPRI_REQ, NULL);
+    taskCreate(TASKID_REQ, reqTask, TASKNAME_REQ, TASKLETTER_REQ, TASKPRI_REQ, reqTaskStack, sizeof(reqTaskStack));
+
+    // Create the task that drains buffered debug output
+    taskCreate(TASKID_LOG, logTask, TASKNAME_LOG, TASKLETTER_LOG, TASKPRI_LOG, logTaskStack, sizeof(logTaskStack));
 
     // Poll, moving serial data from interrupt buffers to app buffers
     for (;;) {
         serialPoll();
+        cpuSample();
     }
 
 }
@@ -125,7 +125,6 @@ void textOutN(char *text, uint32_t len);
 void textOut(const char *format, ...);
 
 // USB
-char printbuf[256];
 uint8_t usbrb[128] = {0};
 volatile uint16_t usbrbReceived = 0;
 
@@ -227,26 +226,22 @@ bool postSelfTest()
 // Counted output handler
 void textOutN(char *text, uint32_t len)
 {
-    debugf(text);
+    debugMessageLen(text, len);
 }
 
-// Output handler
-void textOut(const char *format, ...)
+// Sink for formatted output
+static void textOutSink(void *sinkCtx, const char *buf, uint32_t len)
 {
-    uint32_t printbufLeft = sizeof(printbuf);
+    textOutN((char *) buf, len);
+}
 
-    // Process the printf portion of the work to be done
+// Output handler, streaming the formatted text so that it is never truncated
+void textOut(const char *format, ...)
+{
     va_list args;
     va_start (args, format);
-    vsnprintf (printbuf, printbufLeft, format, args);
+    fmtV(textOutSink, NULL, format, args);
     va_end (args);
-
-    // Make sure it ends in a newline if it's truncated,
-    // just for aesthetics
-    strlcpy(&printbuf[printbufLeft-(strlen(EOL)+1)], EOL, sizeof(printbuf));
-
-    // Output it
-    textOutN(printbuf, strlen(printbuf));
 }
 
 // Test for continuity between two GPIO pins, leaving the pins in an "analog input" state.  In this test, we first do
@@ -4,29 +4,78 @@
 
 #include "app.h"
 
+// Arena high-water marks, tracked by diagnostic command, with unrecognized commands sharing
+// a single bucket so that typos can't crowd out the rest, and with another for JSON requests.
+#define REQ_TYPE_UNKNOWN        CMD_UNRECOGNIZED
+#define REQ_TYPE_JSON           (CMD_UNRECOGNIZED+1)
+#define REQ_TYPES               (CMD_UNRECOGNIZED+2)
+typedef struct {
+    uint32_t requests;
+    uint32_t highWater;
+} arenaStat;
+STATIC arenaStat arenaStats[REQ_TYPES] = {0};
+
+// Forwards
+void reqArenaRecord(int type, memArena *arena);
+
 // Process a request.  Note, it is guaranteed that reqJSON[reqJSONLen] == '\0'
-err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed)
+err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed, memArena *arena)
 {
     err_t err = errNone;
+    PROF_BEGIN(reqProcess);
 
     // Process diagnostic commands
     if (reqJSON[0] != '{') {
         if (!diagAllowed) {
-            return errF("diagnostics not allowed on this port");
+            PROF_END(reqProcess);
+            return errStatic("diagnostics not allowed on this port");
         }
-        err_t err = diagProcess((char *)reqJSON);
+        err_t err = diagProcess((char *)reqJSON, arena);
         if (err) {
             if (!debugPort) {
                 debugf("%s\n", errString(err));
             }
         }
+        reqArenaRecord(getCommand((char *)reqJSON, strlen((char *)reqJSON)), arena);
+        PROF_END(reqProcess);
         return errNone;
     }
 
-    // An example of where an app might process JSON requests
-    err = errF("JSON requests not implemented");
+    // An example of where an app might process JSON requests, whose parser would allocate
+    // what it builds with arrayAllocArena(arena, ...) so that it is released with the request
+    err = errStatic("JSON requests not implemented");
+    reqArenaRecord(REQ_TYPE_JSON, arena);
 
     // Done
+    PROF_END(reqProcess);
     return err;
 
 }
+
+// Record the arena high-water mark of the request that was just processed
+void reqArenaRecord(int type, memArena *arena)
+{
+    if (arena == NULL || type < 0 || type >= REQ_TYPES) {
+        return;
+    }
+    arenaStat *stat = &arenaStats[type];
+    stat->requests++;
+    if (memArenaHighWater(arena) > stat->highWater) {
+        stat->highWater = memArenaHighWater(arena);
+    }
+}
+
+// Display arena usage by request type
+void reqArenaStats(void)
+{
+    debugR("request arena high-water:\n");
+    for (int i=0; i<REQ_TYPES; i++) {
+        arenaStat *stat = &arenaStats[i];
+        if (stat->requests == 0) {
+            continue;
+        }
+        const char *type = (i == REQ_TYPE_JSON) ? "json" : getCommandName(i);
+        debugR("  %12s: %lu bytes (%lu requests)\n", type, (unsigned long) stat->highWater, (unsigned long) stat->requests);
+    }
+    debugR("\n");
+}
@@ -5,33 +5,35 @@
 #include "app.h"
 #include "usart.h"
 
-// A button was pressed
-STATIC bool processButtonPress = false;
-
 // Perform work after sending reply
 uint32_t reqDeferredWork = rdtNone;
 
 // Forwards
 bool processReq(UART_HandleTypeDef *huart);
-bool processButton(void);
 
 // Request task
 void reqTask(void *params)
 {
 
-    // Init task
-    taskRegister(TASKID_REQ, TASKNAME_REQ, TASKLETTER_REQ, TASKSTACK_REQ);
+    // Wake only for ports with requests ready, and check all of them once to start
+    uint32_t ports = TASK_EVENT_PORT_LPUART1 | TASK_EVENT_PORT_USART1 | TASK_EVENT_PORT_USB;
+    taskSubscribe(TASKID_REQ, ports);
+    uint32_t pending = ports;
 
-    // Loop, extracting requests from the serial ports and processing them
+    // Loop, extracting requests from the ports that signalled and processing them, and leaving a
+    // port pending until it has nothing more to process
     while (true) {
-
-        bool didSomething = false;
-        didSomething |= processReq(&hlpuart1);
-        didSomething |= processReq(&huart1);
-        didSomething |= processReq(NULL);
-        didSomething |= processButton();
-        if (!didSomething) {
-            taskTake(TASKID_REQ, ms1Hour);
+        if ((pending & TASK_EVENT_PORT_LPUART1) != 0 && !processReq(&hlpuart1)) {
+            pending &= ~TASK_EVENT_PORT_LPUART1;
+        }
+        if ((pending & TASK_EVENT_PORT_USART1) != 0 && !processReq(&huart1)) {
+            pending &= ~TASK_EVENT_PORT_USART1;
+        }
+        if ((pending & TASK_EVENT_PORT_USB) != 0 && !processReq(NULL)) {
+            pending &= ~TASK_EVENT_PORT_USB;
+        }
+        if (pending == 0) {
+            pending = taskTakeEvents(TASKID_REQ, ms1Hour, TASK_IDLE_SLACK_MS);
         }
     }
 
@@ -62,13 +64,14 @@ bool processReq(UART_HandleTypeDef *huart)
     ledEnable(true);
 
     // Process the request (which is conveniently null-terminated by the serial subsystem)
+    memArena *arena = serialArena(huart);
     if (serialIsDebugPort(huart)) {
         serialSetDebugPort(huart);
         bool debugWasEnabled = MX_DBG_Enable(false);
-        err = reqProcess(true, reqJSON, diagAllowed);
+        err = reqProcess(true, reqJSON, diagAllowed, arena);
         MX_DBG_Enable(debugWasEnabled);
     } else {
-        err = reqProcess(false, reqJSON, diagAllowed);
+        err = reqProcess(false, reqJSON, diagAllowed, arena);
     }
     serialUnlock(huart, true);
     if (err) {
@@ -79,9 +82,10 @@ bool processReq(UART_HandleTypeDef *huart)
     // Busy LED
     ledEnable(false);
 
-    // Perform deferred work
+    // Perform deferred work, after giving the response time to drain.  The exact moment doesn't
+    // matter, so let the wakeup coincide with another task's.
     if (reqDeferredWork != rdtNone) {
-        timerMsSleep(1500);
+        timerMsSleepSlack(1500, 500);
         switch (reqDeferredWork) {
         case rdtRestart:
             debugPanic("restart");
@@ -97,34 +101,3 @@ bool processReq(UART_HandleTypeDef *huart)
     return true;
 
 }
-
-// Note that the button was pressed
-void reqButtonPressedISR()
-{
-    processButtonPress = true;
-    taskGiveFromISR(TASKID_REQ);
-}
-
-// Process button press
-bool processButton()
-{
-    if (!processButtonPress) {
-        return false;
-    }
-    processButtonPress = false;
-
-    // Give positive indication that we're still alive
-    int iterations = 2;
-    for (int i=0; i<iterations; i++) {
-        ledEnable(true);
-        timerMsSleep(100);
-        ledEnable(false);
-        if (i != iterations-1) {
-            timerMsSleep(100);
-        }
-    }
-
-    // Done
-    return true;
-
-}
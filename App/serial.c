@@ -17,7 +17,8 @@ typedef struct {
     bool swallowNextNewline;
     mutex rxLock;
     mutex txLock;
-    int taskId;
+    uint32_t event;             // Signalled when a request is ready
+    memArena arena;
 } serialDesc;
 STATIC serialDesc usbDesc = {0};
 #if ENABLE_USART1
@@ -37,8 +38,6 @@ STATIC uint8_t usart1InterruptBuffer[600];
 STATIC uint8_t usart2InterruptBuffer[600];
 #endif
 STATIC uint8_t usbInterruptBuffer[600];
-STATIC uint8_t isrDebugOutput[120];             // some messages will get truncated but who cares
-STATIC uint32_t isrDebugOutputLen = 0;
 
 // Last time we did work moving serial data
 STATIC int64_t lastTimeDidWorkMs = 0L;
@@ -55,7 +54,15 @@ bool serialActive = false;
 // Forwards
 void serialReceivedNotification(UART_HandleTypeDef *huart, uint32_t error, bool overrun);
 bool pollPort(UART_HandleTypeDef *huart);
-void debugOutput(uint8_t *buf, uint32_t buflen);
+bool pollPortActivity(UART_HandleTypeDef *huart);
+
+// Allocate a port's request arena.  If that fails, requests on the port use the heap instead.
+STATIC void serialArenaInit(serialDesc *desc, uint32_t size)
+{
+    if (memArenaInit(&desc->arena, size) != errNone) {
+        debugError(DEBUG_SERIAL, "serial: cannot allocate %lu-byte request arena\n", (unsigned long) size);
+    }
+}
 
 // Serial poller init
 void serialInit(uint32_t taskID)
@@ -78,15 +85,26 @@ void serialInit(uint32_t taskID)
     mutexInit(&usart2Desc.txLock, MTX_SERIAL_TX);
 #endif
 
-    // Set the tasks of the handlers
-    usbDesc.taskId = TASKID_REQ;
-    lpuart1Desc.taskId = TASKID_REQ;
+    // Allocate the arenas that hold each port's request and what its processing allocates
+    serialArenaInit(&lpuart1Desc, SERIAL_ARENA_LPUART1);
+    serialArenaInit(&usbDesc, SERIAL_ARENA_USB);
+#if ENABLE_USART1
+    serialArenaInit(&usart1Desc, SERIAL_ARENA_USART1);
+#endif
+#if ENABLE_USART2
+    serialArenaInit(&usart2Desc, SERIAL_ARENA_USART2);
+#endif
+
+    // Set the events signalled by the handlers, and poll whenever USB comes or goes
+    usbDesc.event = TASK_EVENT_PORT_USB;
+    lpuart1Desc.event = TASK_EVENT_PORT_LPUART1;
 #if ENABLE_USART1
-    usart1Desc.taskId = TASKID_REQ;
+    usart1Desc.event = TASK_EVENT_PORT_USART1;
 #endif
 #if ENABLE_USART2
-    usart2Desc.taskId = TASKID_REQ;
+    usart2Desc.event = TASK_EVENT_PORT_USART2;
 #endif
+    taskSubscribe(serialTaskID, TASK_EVENT_USB_CHANGE);
 
     // LPUART1
     MX_UART_RxConfigure(&hlpuart1, lpuart1InterruptBuffer, sizeof(lpuart1InterruptBuffer), serialReceivedNotification);
@@ -107,8 +125,9 @@ void serialInit(uint32_t taskID)
     // USB (debug port)
     MX_UART_RxConfigure(NULL, usbInterruptBuffer, sizeof(usbInterruptBuffer), serialReceivedNotification);
 
-    // Set debug function
-    MX_DBG_SetOutput(debugOutput);
+    // Set debug function, buffered so that callers never wait for the port
+    MX_DBG_SetOutput(logOutput);
+    MX_DBG_SetFlush(logFlush);
 
 }
 
@@ -134,10 +153,6 @@ void serialPoll(void)
         didSomething |= pollPort(&huart1);
         didSomething |= pollPort(&huart2);
         didSomething |= pollPort(NULL);
-        if (isrDebugOutputLen > 0) {
-            debugOutput(isrDebugOutput, isrDebugOutputLen);
-            isrDebugOutputLen = 0;
-        }
         didWork |= didSomething;
         if (!didSomething) {
             break;
@@ -156,8 +171,8 @@ void serialPoll(void)
         serialActive = false;
     }
 
-    // Wait until there's something to do
-    taskTake(serialTaskID, pollMs);
+    // Wait until there's something to do, letting the long idle wait coincide with other tasks'
+    taskTakeEvents(serialTaskID, pollMs, pollMs == ms1Hour ? TASK_IDLE_SLACK_MS : 0);
 
 }
 
@@ -170,6 +185,7 @@ bool serialIsActive(void)
 // Notification
 void serialReceivedNotification(UART_HandleTypeDef *huart, uint32_t error, bool overrun)
 {
+    ktraceRecord(KTRACE_RX_NOTIFY, overrun ? 0x80000000 : error);
     if (serialTaskID != TASKID_UNKNOWN) {
 
         // Because notifications are received (on LPUART1) before the character
@@ -181,6 +197,13 @@ void serialReceivedNotification(UART_HandleTypeDef *huart, uint32_t error, bool
         // Wake the serial task
         taskGiveFromISR(serialTaskID);
 
+        // Trace, which is safe from an ISR because debug output is buffered
+        if (overrun) {
+            debugWarn(DEBUG_SERIAL, "serial: receive overrun\n");
+        } else if (error != 0) {
+            debugTrace(DEBUG_SERIAL, "serial: receive error 0x%lx\n", (unsigned long) error);
+        }
+
     }
 }
 
@@ -205,6 +228,16 @@ serialDesc *portDesc(UART_HandleTypeDef *huart)
 
 // See if there's port activity
 bool pollPort(UART_HandleTypeDef *huart)
+{
+    bool didSomething = false;
+    PROF_SCOPE(pollPort) {
+        didSomething = pollPortActivity(huart);
+    }
+    return didSomething;
+}
+
+// Take a byte from the port, if one is available
+bool pollPortActivity(UART_HandleTypeDef *huart)
 {
 
     // Get the descriptor
@@ -231,7 +264,7 @@ bool pollPort(UART_HandleTypeDef *huart)
     mutexLock(&desc->rxLock);
     if (desc->bytesTerminated) {
         mutexUnlock(&desc->rxLock);
-        taskGive(desc->taskId);
+        taskSignal(desc->event);
         timerMsSleep(50);
         return false;
     }
@@ -239,12 +272,16 @@ bool pollPort(UART_HandleTypeDef *huart)
     // Get the databyte
     uint8_t databyte = MX_UART_RxGet(huart);
 
-    // Alloc if new
+    // Alloc if new, from the port's arena so that the request and everything allocated while
+    // processing it are released together when the port is unlocked
     if (desc->bytes == NULL) {
-        if (arrayAllocBytes(&desc->bytes) != errNone) {
+        if (arrayAllocArena(&desc->arena, 0, NULL, &desc->bytes) != errNone) {
             mutexUnlock(&desc->rxLock);
             return false;
         }
+        // Presize for a typical request so that it's received without being reallocated.  If
+        // that fails the array simply grows as bytes arrive, which fails the same way if at all.
+        arrayReserve(desc->bytes, SERIAL_REQUEST_RESERVE);
         desc->bytesTerminated = false;
     }
 
@@ -258,11 +295,13 @@ bool pollPort(UART_HandleTypeDef *huart)
     // Awaken request processing task if a control character, because it's a waste to do otherwise
     if (databyte == '\r' || databyte == '\n') {
         desc->swallowNextNewline = (databyte == '\r');
-        if (desc->taskId != TASKID_UNKNOWN) {
+        if (desc->event != 0) {
             desc->bytesTerminated = true;
-            taskGive(desc->taskId);
+            taskSignal(desc->event);
         }
+        uint32_t requestLen = arrayLength(desc->bytes);
         mutexUnlock(&desc->rxLock);
+        debugTrace(DEBUG_SERIAL, "serial: %lu-byte request\n", (unsigned long) requestLen);
         return true;
     }
     desc->swallowNextNewline = false;
@@ -332,19 +371,31 @@ void serialUnlock(UART_HandleTypeDef *huart, bool reset)
         return;
     }
 
-    // Reset if desired
+    // Reset if desired, releasing everything that the request allocated from the arena
     if (reset) {
         if (desc->bytes != NULL) {
             arrayFree(desc->bytes);
             desc->bytes = NULL;
         }
         desc->bytesTerminated = false;
+        memArenaReset(&desc->arena);
     }
 
     // Unlock
     mutexUnlock(&desc->rxLock);
 }
 
+// Get the arena for the request currently being processed on a port.  This is only
+// valid between serialLock() and serialUnlock(), as the arena is reset on unlock.
+memArena *serialArena(UART_HandleTypeDef *huart)
+{
+    serialDesc *desc = portDesc(huart);
+    if (desc == NULL) {
+        return NULL;
+    }
+    return &desc->arena;
+}
+
 // Output string to debug uart
 void serialOutputString(UART_HandleTypeDef *huart, char *buf)
 {
@@ -370,22 +421,10 @@ bool serialSetDebugPort(UART_HandleTypeDef *huart)
     return true;
 }
 
-// Debug output
-void debugOutput(uint8_t *buf, uint32_t buflen)
+// Debug output, which is called by the log task and must not be called from an ISR
+void serialDebugOutput(uint8_t *buf, uint32_t buflen)
 {
 
-    // Buffer the output as debug output if we're in an ISR (which ST's middleware does)
-    if (MX_InISR()) {
-        uint32_t left = sizeof(isrDebugOutput)-isrDebugOutputLen;
-        if (buflen > left) {
-            buflen = left;
-        }
-        memcpy(&isrDebugOutput[isrDebugOutputLen], buf, buflen);
-        isrDebugOutputLen += buflen;
-        taskGiveFromISR(serialTaskID);
-        return;
-    }
-
     // Output to USB if it's detected
     if (serialDebugUart == NULL) {
         if (osUsbDetected()) {
@@ -433,6 +472,9 @@ void serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen)
     uint8_t *terminator = (uint8_t *) "\r\n";;
     uint32_t terminatorLen = 2;
 
+    // Make sure that buffered debug output precedes the response
+    logFlush();
+
     serialDesc *desc = portDesc(huart);
     if (desc == NULL) {
         return;
@@ -59,7 +59,9 @@ extern uint32_t SystemCoreClock;
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
 #define configTOTAL_HEAP_SIZE                    ((size_t)3000)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS  1
 #define configUSE_TRACE_FACILITY                 1
+#define configGENERATE_RUN_TIME_STATS            1
 #define configUSE_16_BIT_TICKS                   0
 #define configUSE_MUTEXES                        1
 #define configQUEUE_REGISTRY_SIZE                8
@@ -105,6 +107,7 @@ extern uint32_t SystemCoreClock;
 #define INCLUDE_xTaskGetCurrentTaskHandle    1
 #define INCLUDE_eTaskGetState                1
 #define INCLUDE_xTaskGetHandle               1
+#define INCLUDE_xTaskGetIdleTaskHandle       1
 
 // The CMSIS-RTOS V2 FreeRTOS wrapper is dependent on the heap implementation used
 // by the application thus the correct define need to be enabled below
@@ -157,6 +160,29 @@ void appPreSleepProcessing(uint32_t ulExpectedIdleTime);
 void appPostSleepProcessing(uint32_t ulExpectedIdleTime);
 #endif // defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
 
+// Run time stats are counted in microseconds derived from the DWT cycle counter, continuing
+// across STOP2.  See cpu.c.
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+void cpuRunTimeInit(void);
+uint32_t cpuRunTimeCounter(void);
+#endif // defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    cpuRunTimeInit()
+#define portGET_RUN_TIME_COUNTER_VALUE()            cpuRunTimeCounter()
+
+// Kernel events are recorded for the "ktrace" diag command.  See ktrace.c.
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+#include "ktrace.h"
+#define traceTASK_SWITCHED_IN()                     ktraceRecord(KTRACE_SWITCH, 0)
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue)     ktraceQueue(KTRACE_QUEUE_BLOCK, (pxQueue)->ucQueueType, (pxQueue))
+#define traceQUEUE_RECEIVE(pxQueue)                 ktraceQueue(KTRACE_QUEUE_RECEIVE, (pxQueue)->ucQueueType, (pxQueue))
+#define traceQUEUE_SEND(pxQueue)                    ktraceQueue(KTRACE_QUEUE_SEND, (pxQueue)->ucQueueType, (pxQueue))
+#define traceTASK_NOTIFY()                          ktraceRecord(KTRACE_NOTIFY, pxTCB->uxTCBNumber)
+#define traceTASK_NOTIFY_FROM_ISR()                 ktraceRecord(KTRACE_NOTIFY, pxTCB->uxTCBNumber)
+#define traceTASK_NOTIFY_GIVE_FROM_ISR()            ktraceRecord(KTRACE_NOTIFY, pxTCB->uxTCBNumber)
+#define traceTASK_NOTIFY_TAKE_BLOCK()               ktraceRecord(KTRACE_NOTIFY_BLOCK, 0)
+#define traceTASK_NOTIFY_TAKE()                     ktraceRecord(KTRACE_NOTIFY_TAKE, 0)
+#endif // defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+
 // The configPRE_SLEEP_PROCESSING() and configPOST_SLEEP_PROCESSING() macros
 // allow the application writer to add additional code before and after the MCU is
 // placed into the low power state respectively.
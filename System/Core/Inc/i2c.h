@@ -5,6 +5,7 @@
 #pragma once
 
 #include "main.h"
+#include "coro.h"
 
 extern I2C_HandleTypeDef hi2c1;
 extern I2C_HandleTypeDef hi2c3;
@@ -22,3 +23,22 @@ bool MY_I2C3_ReadRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t
 bool MY_I2C3_WriteRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t datalen, uint32_t timeoutMs);
 bool MY_I2C3_Transmit(uint16_t i2cAddress, void *data, uint16_t datalen, uint32_t timeoutMs);
 bool MY_I2C3_Receive(uint16_t i2cAddress, void *data, uint16_t maxdatalen, uint32_t timeoutMs);
+
+bool MY_I2C_ReadRegisterAsync(I2C_HandleTypeDef *hi2c, uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t maxdatalen, coro *waiter);
+bool MY_I2C_WriteRegisterAsync(I2C_HandleTypeDef *hi2c, uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t datalen, coro *waiter);
+bool MY_I2C_Busy(I2C_HandleTypeDef *hi2c);
+bool MY_I2C_Failed(I2C_HandleTypeDef *hi2c);
+
+// A register read-modify-write done by a coroutine, whose arg points to this
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t i2cAddress;
+    uint8_t reg;
+    uint8_t mask;                       // Bits to change
+    uint8_t bits;                       // Their new values
+    uint32_t timeoutMs;                 // For each transfer
+    uint8_t value;
+    uint32_t retries;
+    bool success;
+} i2cRegisterUpdate;
+bool MY_I2C_UpdateRegisterCoro(coro *c);
@@ -38,6 +38,8 @@ void MX_GetUniqueId(uint8_t *id);
 
 // stm32l4xx_it.c
 void Error_Handler(void);
+void MX_ISR_Stats(void);
+void MX_ISR_StatsReset(void);
 
 // stm32l4xx_hal_timebase_tim.c
 void HAL_SuspendTick(void);
@@ -68,6 +70,8 @@ void MX_JumpToBootloader(void);
 bool MX_DBG_Active(void);
 void MX_DBG_Init(void);
 void MX_DBG_SetOutput(void (*fn)(uint8_t *buf, uint32_t buflen));
+void MX_DBG_SetFlush(void (*fn)(void));
+void MX_DBG_Flush(void);
 void MX_DBG(const char *message, size_t length);
 bool MX_DBG_Enable(bool on);
 
@@ -41,4 +41,5 @@ bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len,
 
 // Receive complete for USB serial device
 void MX_USB_RxCplt(uint8_t* buf, uint32_t buflen);
+void MX_USB_TxCplt(void);
 
@@ -16,6 +16,7 @@ bool dbgEnabled = false;
 
 // Debug state
 static void (*dbgOutputFn)(uint8_t *buf, uint32_t buflen) = NULL;
+static void (*dbgFlushFn)(void) = NULL;
 
 // For panic breakpoint
 void MX_Breakpoint()
@@ -79,6 +80,20 @@ void MX_DBG_SetOutput(void (*fn)(uint8_t *buf, uint32_t buflen))
     dbgOutputFn = fn;
 }
 
+// Set the function that writes any output buffered by the output function
+void MX_DBG_SetFlush(void (*fn)(void))
+{
+    dbgFlushFn = fn;
+}
+
+// Write any buffered debug output, such as before a restart
+void MX_DBG_Flush(void)
+{
+    if (dbgFlushFn != NULL) {
+        dbgFlushFn();
+    }
+}
+
 // Enable/disable debug output
 bool MX_DBG_Enable(bool on)
 {
@@ -3,13 +3,34 @@
 // copyright holder including that found in the LICENSE file.
 
 #include "i2c.h"
+#include "global.h"
+#include "mutex.h"
 
 I2C_HandleTypeDef hi2c1;
 I2C_HandleTypeDef hi2c3;
 
+// Asynchronous transfers that find the bus busy are retried this often, this many times
+#define I2C_ASYNC_RETRY_MS      5
+#define I2C_ASYNC_RETRIES       20
+
 uint32_t i2c1IOCompletions = 0;
 uint32_t i2c3IOCompletions = 0;
 
+// Coroutines to wake when asynchronous I/O completes
+STATIC coro *i2c1Waiter = NULL;
+STATIC coro *i2c3Waiter = NULL;
+
+// Tasks waiting for synchronous I/O to complete
+STATIC taskCompletion i2c1Completion = {0};
+STATIC taskCompletion i2c3Completion = {0};
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint32_t ioCount;
+} i2cIO;
+
+// Forwards
+STATIC bool i2cWait(I2C_HandleTypeDef *hi2c, uint32_t ioCount, uint32_t timeoutMs);
+
 // I2C1 init function
 void MX_I2C1_Init(void)
 {
@@ -57,17 +78,7 @@ bool MY_I2C1_ReadRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c1IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c1, ioCount, timeoutMs);
 }
 
 // Write a register, and return true for success or false for failure
@@ -78,17 +89,7 @@ bool MY_I2C1_WriteRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c1IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c1, ioCount, timeoutMs);
 }
 
 // Transmit, and return true for success or false for failure
@@ -99,16 +100,7 @@ bool MY_I2C1_Transmit(uint16_t i2cAddress, void *data, uint16_t datalen, uint32_
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    bool success = true;
-    while (success && ioCount == i2c1IOCompletions) {
-        HAL_Delay(1);
-        waitedMs++;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c1, ioCount, timeoutMs);
 }
 
 // Receive, and return true for success or false for failure
@@ -119,17 +111,7 @@ bool MY_I2C1_Receive(uint16_t i2cAddress, void *data, uint16_t maxdatalen, uint3
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c1IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c1, ioCount, timeoutMs);
 }
 
 // I2C3 init function
@@ -179,17 +161,7 @@ bool MY_I2C3_ReadRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c3IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c3, ioCount, timeoutMs);
 }
 
 // Write a register, and return true for success or false for failure
@@ -200,17 +172,7 @@ bool MY_I2C3_WriteRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c3IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c3, ioCount, timeoutMs);
 }
 
 // Transmit, and return true for success or false for failure
@@ -221,16 +183,7 @@ bool MY_I2C3_Transmit(uint16_t i2cAddress, void *data, uint16_t datalen, uint32_
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    bool success = true;
-    while (success && ioCount == i2c3IOCompletions) {
-        HAL_Delay(1);
-        waitedMs++;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c3, ioCount, timeoutMs);
 }
 
 // Receive, and return true for success or false for failure
@@ -241,17 +194,7 @@ bool MY_I2C3_Receive(uint16_t i2cAddress, void *data, uint16_t maxdatalen, uint3
     if (status != HAL_OK) {
         return false;
     }
-    uint32_t waitedMs = 0;
-    uint32_t waitGranularityMs = 1;
-    bool success = true;
-    while (success && ioCount == i2c3IOCompletions) {
-        HAL_Delay(waitGranularityMs);
-        waitedMs += waitGranularityMs;
-        if (timeoutMs != 0 && waitedMs > timeoutMs) {
-            success = false;
-        }
-    }
-    return success;
+    return i2cWait(&hi2c3, ioCount, timeoutMs);
 }
 
 // I2C msp init
@@ -364,6 +307,125 @@ void HAL_I2C_MspDeInit(I2C_HandleTypeDef* i2cHandle)
 
 }
 
+// Get the waiter slot for a bus
+STATIC coro **i2cWaiter(I2C_HandleTypeDef *hi2c)
+{
+    return (hi2c == &hi2c1) ? &i2c1Waiter : &i2c3Waiter;
+}
+
+// Start reading a register, waking the coroutine when done.  Returns false if the bus is busy or
+// the read couldn't be started, in which case the coroutine may simply await a retry.
+bool MY_I2C_ReadRegisterAsync(I2C_HandleTypeDef *hi2c, uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t maxdatalen, coro *waiter)
+{
+    if (MY_I2C_Busy(hi2c)) {
+        return false;
+    }
+    *i2cWaiter(hi2c) = waiter;
+    if (HAL_I2C_Mem_Read_IT(hi2c, ((uint16_t)i2cAddress) << 1, (uint16_t)Reg, I2C_MEMADD_SIZE_8BIT, data, maxdatalen) != HAL_OK) {
+        *i2cWaiter(hi2c) = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Start writing a register, waking the coroutine when done.  Returns false if the bus is busy or
+// the write couldn't be started.
+bool MY_I2C_WriteRegisterAsync(I2C_HandleTypeDef *hi2c, uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t datalen, coro *waiter)
+{
+    if (MY_I2C_Busy(hi2c)) {
+        return false;
+    }
+    *i2cWaiter(hi2c) = waiter;
+    if (HAL_I2C_Mem_Write_IT(hi2c, ((uint16_t)i2cAddress) << 1, (uint16_t)Reg, I2C_MEMADD_SIZE_8BIT, data, datalen) != HAL_OK) {
+        *i2cWaiter(hi2c) = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Read a register, replace the bits selected by the mask, and write it back, without holding a
+// task while either transfer is on the bus.  Start it with coroStart(c, MY_I2C_UpdateRegisterCoro,
+// update, priority), and once coroIsDone(c), update->success says whether the register was written.
+bool MY_I2C_UpdateRegisterCoro(coro *c)
+{
+    i2cRegisterUpdate *u = (i2cRegisterUpdate *) c->arg;
+    CORO_BEGIN(c);
+    u->success = false;
+
+    // Read the register, retrying while another transfer has the bus
+    u->retries = 0;
+    while (!MY_I2C_ReadRegisterAsync(u->hi2c, u->i2cAddress, u->reg, &u->value, 1, c)) {
+        if (++u->retries > I2C_ASYNC_RETRIES) {
+            CORO_EXIT(c);
+        }
+        CORO_SLEEP(c, I2C_ASYNC_RETRY_MS);
+    }
+    CORO_AWAIT_TIMEOUT(c, !MY_I2C_Busy(u->hi2c), u->timeoutMs);
+    if (coroTimedOut(c) || MY_I2C_Failed(u->hi2c)) {
+        CORO_EXIT(c);
+    }
+
+    // Write it back with the selected bits replaced
+    u->value = (u->value & ~u->mask) | (u->bits & u->mask);
+    u->retries = 0;
+    while (!MY_I2C_WriteRegisterAsync(u->hi2c, u->i2cAddress, u->reg, &u->value, 1, c)) {
+        if (++u->retries > I2C_ASYNC_RETRIES) {
+            CORO_EXIT(c);
+        }
+        CORO_SLEEP(c, I2C_ASYNC_RETRY_MS);
+    }
+    CORO_AWAIT_TIMEOUT(c, !MY_I2C_Busy(u->hi2c), u->timeoutMs);
+    if (coroTimedOut(c) || MY_I2C_Failed(u->hi2c)) {
+        CORO_EXIT(c);
+    }
+
+    u->success = true;
+    CORO_END(c);
+}
+
+// See whether a transfer is in progress on the bus
+bool MY_I2C_Busy(I2C_HandleTypeDef *hi2c)
+{
+    return HAL_I2C_GetState(hi2c) != HAL_I2C_STATE_READY;
+}
+
+// See whether the last transfer on the bus failed
+bool MY_I2C_Failed(I2C_HandleTypeDef *hi2c)
+{
+    return HAL_I2C_GetError(hi2c) != HAL_I2C_ERROR_NONE;
+}
+
+// See whether the I/O started on a bus has completed or failed
+STATIC bool i2cDone(void *arg)
+{
+    i2cIO *io = (i2cIO *) arg;
+    uint32_t completions = (io->hi2c == &hi2c1) ? i2c1IOCompletions : i2c3IOCompletions;
+    return completions != io->ioCount;
+}
+
+// Wait for the I/O started on a bus to complete, blocking the task rather than spinning where
+// possible, and return true for success.  A timeout of 0 waits forever.
+STATIC bool i2cWait(I2C_HandleTypeDef *hi2c, uint32_t ioCount, uint32_t timeoutMs)
+{
+    i2cIO io = {hi2c, ioCount};
+    taskCompletion *c = (hi2c == &hi2c1) ? &i2c1Completion : &i2c3Completion;
+    if (!taskCompletionWait(c, i2cDone, &io, timeoutMs == 0 ? TASK_WAIT_FOREVER : timeoutMs)) {
+        return false;
+    }
+    return !MY_I2C_Failed(hi2c);
+}
+
+// Wake the task or coroutine waiting on a bus, if any
+STATIC void i2cWake(I2C_HandleTypeDef *hi2c)
+{
+    taskCompletionSignalFromISR((hi2c == &hi2c1) ? &i2c1Completion : &i2c3Completion);
+    coro **waiter = i2cWaiter(hi2c);
+    if (*waiter != NULL) {
+        coroWakeFromISR(*waiter);
+        *waiter = NULL;
+    }
+}
+
 // I2C1 DMA completion events
 void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
 {
@@ -373,6 +435,7 @@ void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
     if (hi2c == &hi2c3) {
         i2c3IOCompletions++;
     }
+    i2cWake(hi2c);
 }
 
 void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
@@ -383,6 +446,7 @@ void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
     if (hi2c == &hi2c3) {
         i2c3IOCompletions++;
     }
+    i2cWake(hi2c);
 }
 
 void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
@@ -393,6 +457,7 @@ void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
     if (hi2c == &hi2c3) {
         i2c3IOCompletions++;
     }
+    i2cWake(hi2c);
 }
 
 void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
@@ -403,4 +468,17 @@ void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
     if (hi2c == &hi2c3) {
         i2c3IOCompletions++;
     }
+    i2cWake(hi2c);
+}
+
+// I2C error, which completes the I/O in failure
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c == &hi2c1) {
+        i2c1IOCompletions++;
+    }
+    if (hi2c == &hi2c3) {
+        i2c3IOCompletions++;
+    }
+    i2cWake(hi2c);
 }
@@ -16,6 +16,7 @@
 #include "usart.h"
 #include "spi.h"
 #include "timer_if.h"
+#include "global.h"
 
 // Peripherals that are currently active
 uint32_t peripherals = 0;
@@ -63,6 +64,9 @@ int main(void)
     // Configure the system clock
     SystemClock_Config();
 
+    // Start the cycle counter used by profiling probes
+    profInit();
+
     // Start the HAL timer
     HAL_InitTick(TICK_INT_PRIORITY);
 
@@ -94,6 +98,9 @@ void SystemClock_Config(void)
     RCC_OscInitTypeDef RCC_OscInitStruct = {0};
     RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
 
+    // Account for the cycles run at the clock that we're about to change
+    timerUs();
+
     // Configure LSE Drive Capability
     HAL_PWR_EnableBkUpAccess();
     __HAL_RCC_LSEDRIVE_CONFIG(RCC_LSEDRIVE_LOW);
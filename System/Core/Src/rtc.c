@@ -4,6 +4,7 @@
 
 #include "main.h"
 #include "rtc.h"
+#include "global.h"
 
 RTC_HandleTypeDef hrtc;
 
@@ -203,7 +204,6 @@ bool MX_RTC_SetDateTime(int year, int mon1, int day1, int hour0, int min0, int s
 }
 
 // RTC GetMs function which is guaranteed never to go backwards
-#define is_leap(year) (((year) % 4) == 0 && (((year) % 100) != 0 || ((year) % 400) == 0))
 int64_t MX_RTC_GetMs()
 {
 
@@ -211,49 +211,13 @@ int64_t MX_RTC_GetMs()
     int year, mon1, day1, hour0, min0, sec0, ms0;
     MX_RTC_GetDateTime(&year, &mon1, &day1, &hour0, &min0, &sec0, &ms0);
 
-    // Set up for timegm()
-    int tm_mon = mon1-1;
-    int tm_mday = day1;
-    int tm_hour = hour0;
-    int tm_min = min0;
-    int tm_sec = sec0;
-
-    // Private timegm() function
-    static const unsigned cumdays[2][12] = {
-        {31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
-        {31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366}
-    };
-    bool year_is_leap = is_leap(year);
-
-    // Optimization for a very stupid algorithm
-    int64_t res = 0;
-    if (year >= 2020) {
-        res = 18262;
-        for (unsigned i = 2020; i < year; ++i) {
-            res += is_leap(i) ? 366 : 365;
-        }
-    } else {
-        for (unsigned i = 1970; i < year; ++i) {
-            res += is_leap(i) ? 366 : 365;
-        }
-    }
-
-    // Another stupid algorithm replaced with optimization
-    if (tm_mon > 0) {
-        res += cumdays[year_is_leap][tm_mon-1];
-    }
-
-    res += tm_mday - 1;
-    res *= 24;
-    res += tm_hour;
-    res *= 60;
-    res += tm_min;
-    res *= 60;
-    res += tm_sec;
+    // Days since 1970-01-01, in constant time because this is called on every entry to and exit
+    // from STOP2
+    int64_t days = civilDaysFromDate(year, mon1, day1);
 
     // Convert to milliseconds and exit
-    int64_t retMs = ((1000*(int64_t)res) + ms0);
-    return retMs;
+    int64_t secs = (days * 86400) + (hour0 * 3600) + (min0 * 60) + sec0;
+    return (secs * 1000) + ms0;
 
 }
 
@@ -5,6 +5,7 @@
 #include "stm32l4xx_hal.h"
 #include "stm32l4xx_hal_tim.h"
 #include "main.h"
+#include "global.h"
 
 // Timer handle
 TIM_HandleTypeDef        htim2;
@@ -13,8 +14,15 @@ TIM_HandleTypeDef        htim2;
 #define TICKS_PER_SECOND 1000
 #define MILLISECONDS_PER_TICK (1000/TICKS_PER_SECOND)
 __IO uint32_t tickCount;
-__IO int64_t msCountFromTicks = 0;
-__IO int64_t msCountFromSleep = 0;
+
+// The continuous millisecond clock is 64 bits wide and is advanced from the tick ISR and after
+// STOP2, so on this 32-bit core a reader could otherwise see one half before and one half after
+// an update.  Writers bump the sequence to odd before and back to even after they update, with
+// interrupts masked so that they never nest, and readers retry until they see the same even
+// sequence on both sides of their read.  The read path is a handful of loads with no locking.
+STATIC __IO uint32_t msCountSeq = 0;
+STATIC __IO int64_t msCount = 0;
+STATIC __IO int64_t msCountFromSleep = 0;
 
 // This function configures the TIM2 as a time base source.
 // The time source is configured  to have 1ms time base with a dedicated
@@ -120,25 +128,56 @@ void HAL_ResumeTick(void)
     __HAL_TIM_ENABLE_IT(&htim2, TIM_IT_UPDATE);
 }
 
+// Advance the continuous millisecond clock, from the tick ISR or after coming out of STOP2
+STATIC void msCountAdvance(uint32_t ms, bool fromSleep)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    msCountSeq++;
+    __DMB();
+    msCount += ms;
+    if (fromSleep) {
+        msCountFromSleep += ms;
+    }
+    __DMB();
+    msCountSeq++;
+    __set_PRIMASK(primask);
+}
+
 // This is an auxiliary timer tick that occurs, helping us to make sure that we increment
 // the main tick counter on a regular basis even though the main tick counter stops when
 // we're in STOP2 mode.
 void MX_StepTickMs(uint32_t msElapsed)
 {
-    msCountFromSleep += msElapsed;
+    msCountAdvance(msElapsed, true);
 }
 
 // Return the total stepped ticks
 int64_t MX_SteppedTickMs()
 {
-    return msCountFromSleep;
+    uint32_t seq;
+    int64_t ms;
+    do {
+        seq = msCountSeq;
+        __DMB();
+        ms = msCountFromSleep;
+        __DMB();
+    } while ((seq & 1) != 0 || seq != msCountSeq);
+    return ms;
 }
 
 // Bump the tick counts
 void HAL_IncTick(void)
 {
     tickCount++;
-    msCountFromTicks++;
+    msCountAdvance(MILLISECONDS_PER_TICK, false);
+
+    // Keep timerUs(), which is also the run time counter, from missing a wrap of the cycle
+    // counter when no task switches
+    if ((tickCount % TICKS_PER_SECOND) == 0) {
+        timerUs();
+    }
+
 }
 
 // Delay milliseconds in a compute loop
@@ -171,6 +210,13 @@ int64_t MX_GetTickMs(void)
 // Provide an approximate tick value in milliseconds with the illusion that it is continuous, across STOP2.
 int64_t MX_GetTickMsFromISR(void)
 {
-    int64_t ticks = msCountFromTicks;
-    return ticks + msCountFromSleep;
+    uint32_t seq;
+    int64_t ms;
+    do {
+        seq = msCountSeq;
+        __DMB();
+        ms = msCount;
+        __DMB();
+    } while ((seq & 1) != 0 || seq != msCountSeq);
+    return ms;
 }
@@ -5,6 +5,7 @@
 #include "main.h"
 #include "usart.h"
 #include "stm32l4xx_it.h"
+#include "global.h"
 
 extern LPTIM_HandleTypeDef hlptim1;
 extern PCD_HandleTypeDef hpcd_USB_FS;
@@ -27,6 +28,109 @@ extern RTC_HandleTypeDef hrtc;
 extern SAI_HandleTypeDef hsai_BlockA1;
 extern DMA_HandleTypeDef hdma_sai1_a;
 
+// Optional per-IRQ statistics on the handlers most likely to delay serial receive: the duration
+// from entry to exit in cycles, including any higher-priority ISRs that preempted it, a histogram
+// of those durations in powers of 4us, and the deepest nesting in which it was entered.  This
+// costs a few dozen cycles per interrupt.
+#define ISR_STATS               true
+#define ISR_HISTOGRAM_BUCKETS   8
+typedef enum {
+    ISR_TIM2,
+    ISR_RTC_ALARM,
+    ISR_RTC_WKUP,
+    ISR_USB,
+    ISR_LPUART1,
+    ISR_USART1,
+    ISR_USART2,
+    ISR_USART1_RX_DMA,
+    ISR_USART1_TX_DMA,
+    ISR_USART2_RX_DMA,
+    ISR_USART2_TX_DMA,
+    ISR_STAT_COUNT
+} isrStatId;
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t maxDepth;
+    uint64_t total;
+    uint32_t histogram[ISR_HISTOGRAM_BUCKETS];
+} isrStat;
+STATIC const char *isrStatNames[ISR_STAT_COUNT] = {
+    "tim2", "rtc alarm", "rtc wkup", "usb", "lpuart1", "usart1", "usart2",
+    "usart1 rx dma", "usart1 tx dma", "usart2 rx dma", "usart2 tx dma",
+};
+STATIC isrStat isrStats[ISR_STAT_COUNT];
+STATIC volatile uint32_t isrDepth = 0;
+#if ISR_STATS
+#define ISR_BEGIN()     uint32_t isrBegan = isrEnter()
+#define ISR_END(id)     isrExit(id, isrBegan)
+#else
+#define ISR_BEGIN()
+#define ISR_END(id)
+#endif
+
+// Note entry into an instrumented handler.  A handler can only be preempted by one of higher
+// priority, which will have restored the depth by the time it returns, so no locking is needed.
+STATIC uint32_t isrEnter(void)
+{
+    isrDepth++;
+    return profCycles();
+}
+
+// Note exit from an instrumented handler.  Each IRQ's stats are only updated by its own handler,
+// which can't preempt itself.
+STATIC void isrExit(isrStatId id, uint32_t began)
+{
+    uint32_t cycles = profCycles() - began;
+    isrStat *stat = &isrStats[id];
+    if (stat->count == 0 || cycles < stat->min) {
+        stat->min = cycles;
+    }
+    if (cycles > stat->max) {
+        stat->max = cycles;
+    }
+    if (isrDepth > stat->maxDepth) {
+        stat->maxDepth = isrDepth;
+    }
+    stat->total += cycles;
+    stat->count++;
+    uint32_t us = cycles / GMAX(SystemCoreClock / 1000000, 1);
+    uint32_t bucket = (us == 0) ? 0 : ((31 - __CLZ(us)) / 2) + 1;
+    stat->histogram[GMIN(bucket, ISR_HISTOGRAM_BUCKETS-1)]++;
+    isrDepth--;
+}
+
+// Display ISR statistics, in microseconds
+void MX_ISR_Stats(void)
+{
+    uint32_t perUs = GMAX(SystemCoreClock / 1000000, 1);
+    debugR("%-14s %8s %6s %6s %6s %5s  histogram <1/4/16/64/256/1K/4K/more us\n", "isr", "count", "min", "avg", "max", "depth");
+    for (int i=0; i<ISR_STAT_COUNT; i++) {
+        isrStat stat = isrStats[i];
+        if (stat.count == 0) {
+            continue;
+        }
+        char hist[80];
+        uint32_t len = 0;
+        for (int b=0; b<ISR_HISTOGRAM_BUCKETS; b++) {
+            len += fmtString(&hist[len], sizeof(hist)-len, "%s%lu", b == 0 ? "" : "/", (unsigned long) stat.histogram[b]);
+        }
+        debugR("%-14s %8lu %6lu %6lu %6lu %5lu  %s\n", isrStatNames[i], (unsigned long) stat.count,
+               (unsigned long) (stat.min / perUs), (unsigned long) ((stat.total / stat.count) / perUs),
+               (unsigned long) (stat.max / perUs), (unsigned long) stat.maxDepth, hist);
+    }
+}
+
+// Reset ISR statistics
+void MX_ISR_StatsReset(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(isrStats, 0, sizeof(isrStats));
+    __set_PRIMASK(primask);
+}
+
 // This function handles Non maskable interrupt.
 void NMI_Handler(void)
 {
@@ -83,19 +187,25 @@ void assert_failed(uint8_t *file, uint32_t line)
 // This function handles TIM2 Global Interrupt
 void TIM2_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_TIM_IRQHandler(&htim2);
+    ISR_END(ISR_TIM2);
 }
 
 // RTC alarm
 void RTC_Alarm_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_RTC_AlarmIRQHandler(&hrtc);
+    ISR_END(ISR_RTC_ALARM);
 }
 
 // RTC wakeup
 void RTC_WKUP_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_RTCEx_WakeUpTimerIRQHandler(&hrtc);
+    ISR_END(ISR_RTC_WKUP);
 }
 
 // This function handles LPTIM1 global interrupt.
@@ -123,7 +233,9 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 // USB interrupt
 void USB_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_PCD_IRQHandler(&hpcd_USB_FS);
+    ISR_END(ISR_USB);
 }
 
 // This function handles CAN1 TX interrupt.
@@ -177,22 +289,28 @@ void I2C3_ER_IRQHandler(void)
 // This function handles LPUART1 global interrupt.
 void LPUART1_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_UART_IRQHandler(&hlpuart1);
     MX_UART_IDLE_IRQHandler(&hlpuart1);
+    ISR_END(ISR_LPUART1);
 }
 
 // This function handles USART1 global interrupt.
 void USART1_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_UART_IRQHandler(&huart1);
     MX_UART_IDLE_IRQHandler(&huart1);
+    ISR_END(ISR_USART1);
 }
 
 // This function handles USART2 global interrupt.
 void USART2_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_UART_IRQHandler(&huart2);
     MX_UART_IDLE_IRQHandler(&huart2);
+    ISR_END(ISR_USART2);
 }
 
 // This function handles SPI1 global interrupt.
@@ -222,25 +340,33 @@ void SPI2_TX_DMA_IRQHandler(void)
 // This function handles USART2 global interrupt.
 void USART2_RX_DMA_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_DMA_IRQHandler(&hdma_usart2_rx);
+    ISR_END(ISR_USART2_RX_DMA);
 }
 
 // This function handles USART2 global interrupt.
 void USART2_TX_DMA_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_DMA_IRQHandler(&hdma_usart2_tx);
+    ISR_END(ISR_USART2_TX_DMA);
 }
 
 // This function handles USART1 global interrupt.
 void USART1_TX_DMA_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_DMA_IRQHandler(&hdma_usart1_tx);
+    ISR_END(ISR_USART1_TX_DMA);
 }
 
 // This function handles USART1 global interrupt.
 void USART1_RX_DMA_IRQHandler(void)
 {
+    ISR_BEGIN();
     HAL_DMA_IRQHandler(&hdma_usart1_rx);
+    ISR_END(ISR_USART1_RX_DMA);
 }
 
 // This function handles the SAI global interrupt.
@@ -28,9 +28,11 @@ const UTIL_TIMER_Driver_s UTIL_TimerDriver = {
 // Minimum timeout delay of Alarm in ticks
 #define MIN_ALARM_DELAY    3
 
-// Post the RTC log string format to the circular queue for printing in using the polling mode
+// Post the RTC log string format to the circular queue for printing in using the polling mode.
+// This is on every RTC timer path, so it is only compiled in with RTIF_DEBUG, and then it is
+// enabled at runtime with "trace timer trace".
 #ifdef RTIF_DEBUG
-#define TIMER_IF_DBG_PRINTF(...) debugf(__VA_ARGS__)
+#define TIMER_IF_DBG_PRINTF(...) debugTrace(DEBUG_TIMER, __VA_ARGS__)
 #else
 #define TIMER_IF_DBG_PRINTF(...)
 #endif
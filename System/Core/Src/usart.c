@@ -11,6 +11,7 @@
 #include "usart.h"
 #include "usb_device.h"
 #include "global.h"
+#include "mutex.h"
 #include "dma.h"
 #include <stdatomic.h>
 
@@ -58,6 +59,12 @@ UARTIO rxioUSB = {0};
 atomic_int rxtempInUse = 0;
 uint8_t rxtemp[UART_IOBUF_LEN];
 
+// Tasks waiting for transmits to complete
+STATIC taskCompletion txCompletionLPUART1 = {0};
+STATIC taskCompletion txCompletionUSART1 = {0};
+STATIC taskCompletion txCompletionUSART2 = {0};
+STATIC taskCompletion txCompletionUSB = {0};
+
 // Forwards
 bool uioReceivedBytes(UARTIO *uio, uint8_t *buf, uint32_t buflen);
 void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint32_t buflen);
@@ -82,6 +89,32 @@ bool MX_UART_IsDMA(UART_HandleTypeDef *huart)
     return false;
 }
 
+// Get the transmit completion for a port
+STATIC taskCompletion *txCompletion(UART_HandleTypeDef *huart)
+{
+    if (huart == &hlpuart1) {
+        return &txCompletionLPUART1;
+    } else if (huart == &huart1) {
+        return &txCompletionUSART1;
+    } else if (huart == &huart2) {
+        return &txCompletionUSART2;
+    }
+    return &txCompletionUSB;
+}
+
+// See whether a UART has finished transmitting
+STATIC bool uartTxDone(void *arg)
+{
+    UART_HandleTypeDef *huart = (UART_HandleTypeDef *) arg;
+    return (HAL_UART_GetState(huart) & HAL_UART_STATE_BUSY_TX) != HAL_UART_STATE_BUSY_TX;
+}
+
+// See whether USB has finished transmitting
+STATIC bool usbTxDone(void *arg)
+{
+    return CDC_Transmit_Completed() != USBD_BUSY;
+}
+
 // Transmit to a port synchronously, broken up into 64 byte chunks because we have
 // seen repeatedly that hosts are not generally designed to handle large transfers.
 // We've chosen 64 bytes simply due to the fact that USB frame size is 64.
@@ -105,12 +138,12 @@ void MX_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, uin
             if (MX_UART_TransmitFull(huart, buf, chunklen, timeoutMs)) {
                 break;
             }
-            HAL_Delay(1);
+            taskDelayMs(1);
         }
 
         // Delay a bit between chunks
         uint32_t delayBetweenChunksMs = 10;
-        HAL_Delay(delayBetweenChunksMs);
+        taskDelayMs(delayBetweenChunksMs);
         buf += chunklen;
         len -= chunklen;
 
@@ -128,14 +161,8 @@ bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len,
             return false;
         }
         bool success = (CDC_Transmit_FS(buf, len) == USBD_OK);
-        for (uint32_t i=0; success; i++) {
-            if (CDC_Transmit_Completed() != USBD_BUSY) {
-                break;
-            }
-            if (i >= timeoutMs) {
-                return false;
-            }
-            HAL_Delay(1);
+        if (success && !taskCompletionWait(&txCompletionUSB, usbTxDone, NULL, timeoutMs)) {
+            return false;
         }
         return success;
     }
@@ -164,14 +191,8 @@ bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len,
     }
 
     // Wait, so that the caller won't mess with the buffer while the HAL is using it
-    for (uint32_t i=0; success; i++) {
-        if ((HAL_UART_GetState(huart) & HAL_UART_STATE_BUSY_TX) != HAL_UART_STATE_BUSY_TX) {
-            break;
-        }
-        if (i >= timeoutMs) {
-            return false;
-        }
-        HAL_Delay(1);
+    if (success && !taskCompletionWait(txCompletion(huart), uartTxDone, huart, timeoutMs)) {
+        return false;
     }
 
     // Success
@@ -182,11 +203,16 @@ bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len,
 // Transmit complete callback for serial ports
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
+    taskCompletionSignalFromISR(txCompletion(huart));
 }
 
-// We must restart the receive if there is a receive or transmit error
+// We must restart the receive if there is a receive or transmit error.  Only an error that ended
+// a transmit completes it, so a receive error doesn't wake a task waiting for its transmit.
 void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 {
+    if (uartTxDone(huart)) {
+        taskCompletionSignalFromISR(txCompletion(huart));
+    }
     HAL_UART_RxCpltCallback(huart);
 }
 
@@ -374,6 +400,12 @@ void MX_USB_RxCplt(uint8_t* buf, uint32_t buflen)
     receiveComplete(NULL, &rxioUSB, buf, buflen);
 }
 
+// Transmit complete for USB serial device
+void MX_USB_TxCplt(void)
+{
+    taskCompletionSignalFromISR(&txCompletionUSB);
+}
+
 // Receive complete
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
@@ -393,6 +425,8 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 // Receive complete
 void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint32_t buflen)
 {
+    PROF_BEGIN(receiveComplete);
+    ktraceRecord(KTRACE_RX_COMPLETE, buflen);
 
     // If there's an error, abort
     if (huart != NULL && huart->ErrorCode != HAL_UART_ERROR_NONE) {
@@ -400,6 +434,7 @@ void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint3
             uio->notifyReceivedFn(huart, huart->ErrorCode, false);
         }
         MX_UART_RxStart(huart);
+        PROF_END(receiveComplete);
         return;
     }
 
@@ -430,6 +465,7 @@ void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint3
         MX_UART_RxStart(huart);
     }
     atomic_fetch_sub(&rxtempInUse, 1);
+    PROF_END(receiveComplete);
 
 }
 
@@ -616,13 +652,7 @@ void MX_LPUART1_UART_Transmit(uint8_t *buf, uint32_t len, uint32_t timeoutMs)
     HAL_UART_Transmit_IT(&hlpuart1, buf, len);
 
     // Wait, so that the caller won't mess with the buffer while the HAL is using it
-    for (uint32_t i=0; i<timeoutMs; i++) {
-        HAL_UART_StateTypeDef state = HAL_UART_GetState(&hlpuart1);
-        if ((state & HAL_UART_STATE_BUSY_TX) != HAL_UART_STATE_BUSY_TX) {
-            break;
-        }
-        HAL_Delay(1);
-    }
+    taskCompletionWait(&txCompletionLPUART1, uartTxDone, &hlpuart1, timeoutMs);
 
 }
 
@@ -180,5 +180,6 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
     UNUSED(Buf);
     UNUSED(Len);
     UNUSED(epnum);
+    MX_USB_TxCplt();
     return result;
 }
@@ -5,6 +5,230 @@
 #include "global.h"
 #include "mutex.h"
 
+// Allocate an array's buffer, taking it from the array's arena if it has one and there's room
+static err_t arrayMemAlloc(array *ctx, uint32_t length, void *ptr)
+{
+    if (ctx->arena != NULL && memArenaAlloc(ctx->arena, length, ptr) == errNone) {
+        return errNone;
+    }
+    return memAlloc(length, ptr);
+}
+
+// Grow an array's buffer.  A buffer that outgrows its arena moves to the heap rather than
+// failing, after which it is grown and freed there like that of any other array.
+static err_t arrayMemRealloc(array *ctx, uint32_t fromLength, uint32_t toLength, void *ptr)
+{
+    uint8_t *old = * (void **) ptr;
+    if (ctx->arena == NULL || (old != NULL && !memArenaOwns(ctx->arena, old))) {
+        return memRealloc(fromLength, toLength, ptr);
+    }
+    if (memArenaRealloc(ctx->arena, fromLength, toLength, ptr) == errNone) {
+        return errNone;
+    }
+    uint8_t *new;
+    err_t err = memAlloc(toLength, &new);
+    if (err) {
+        return err;
+    }
+    if (old != NULL) {
+        memcpy(new, old, GMIN(fromLength, toLength));
+        memArenaFree(ctx->arena, old);
+    }
+    * (void **) ptr = new;
+    return errNone;
+}
+
+// Free something associated with an array, knowing that arena objects are released only on arena reset
+static void arrayMemFree(array *ctx, void *p)
+{
+    if (memArenaOwns(ctx->arena, p)) {
+        memArenaFree(ctx->arena, p);
+        return;
+    }
+    memFree(p);
+}
+
+// Forwards
+static err_t arrayAppendLen(array *ctx, void *data, uint32_t datalen);
+
+// Default growth policy.  Arrays grow by at least chunksize, and once they are large by a
+// percentage of what is already allocated (capped) so that big arrays aren't built by
+// a long series of reallocations, each of which copies everything.
+#define ARRAY_DEFAULT_CHUNKSIZE         512
+#define ARRAY_DEFAULT_GROWTH_PERCENT    50
+#define ARRAY_DEFAULT_GROWTH_MAX        4096
+
+// Compute how many bytes to add to an array's buffer so that there is room for datalen more
+static uint32_t arrayGrowthLen(array *ctx, uint32_t datalen)
+{
+
+    // Default the chunk size
+    if (ctx->chunksize == 0) {
+        ctx->chunksize = ARRAY_DEFAULT_CHUNKSIZE;
+    }
+
+    // If this is the first allocation, assume that it will be small
+    uint32_t growth = ctx->chunksize;
+    if (ctx->address == NULL) {
+        growth /= 2;
+    } else {
+        uint32_t growthPercent = ctx->growthPercent == 0 ? ARRAY_DEFAULT_GROWTH_PERCENT : ctx->growthPercent;
+        uint32_t growthMax = ctx->growthMax == 0 ? ARRAY_DEFAULT_GROWTH_MAX : ctx->growthMax;
+        uint32_t geometric = GMIN((ctx->allocated / 100) * growthPercent, growthMax);
+        growth = GMAX(growth, geometric);
+    }
+
+    // Ensure that there will be room after alloc
+    return GMAX(growth, datalen);
+
+}
+
+// Grow an array's buffer to the specified number of bytes, preserving the cached position
+static err_t arrayGrowTo(array *ctx, uint32_t allocated)
+{
+    err_t err;
+
+    // Nothing to do if it's already big enough
+    if (allocated <= ctx->allocated && ctx->address != NULL) {
+        return errNone;
+    }
+
+    // Allocate the buffer for the first time
+    if (ctx->address == NULL) {
+        uint8_t *initial;
+        err = arrayMemAlloc(ctx, allocated, &initial);
+        if (err) {
+            return err;
+        }
+        ctx->address = initial;
+        ctx->allocated = allocated;
+        ctx->cachedIndex = 0;
+        ctx->cachedAddress = ctx->address;
+        return errNone;
+    }
+
+    // Grow the buffer
+    uint32_t cachedOffset = (uint32_t) ((uint8_t *)ctx->cachedAddress - (uint8_t *)ctx->address);
+    if (ctx->cachedAddress == NULL) {
+        cachedOffset = 0;
+    }
+    err = arrayMemRealloc(ctx, ctx->allocated, allocated, &ctx->address);
+    if (err) {
+        return err;
+    }
+    ctx->allocated = allocated;
+    if (cachedOffset == 0) {
+        ctx->cachedAddress = ctx->address;
+        ctx->cachedIndex = 0;
+    } else {
+        ctx->cachedAddress = (uint8_t *) ctx->address + cachedOffset;
+    }
+    return errNone;
+
+}
+
+// Set the growth policy of an array.  Zero for any parameter selects the default.
+void arrayGrowth(array *ctx, uint16_t chunksize, uint16_t growthPercent, uint32_t growthMax)
+{
+    ctx->chunksize = chunksize;
+    ctx->growthPercent = growthPercent;
+    ctx->growthMax = growthMax;
+}
+
+// Ensure that the array has at least the specified number of bytes allocated, so that
+// builders that know their output size in advance can allocate exactly once.
+err_t arrayReserve(array *ctx, uint32_t bytes)
+{
+    if (bytes == 0 || (ctx->address != NULL && bytes <= ctx->allocated)) {
+        return errNone;
+    }
+    return arrayGrowTo(ctx, bytes);
+}
+
+// Make sure that a string array's offset index has room for the specified number of entries
+static bool arrayIndexGrow(array *ctx, uint32_t entries)
+{
+    if (entries <= ctx->offsetsAllocated && ctx->offsets != NULL) {
+        return true;
+    }
+    if (entries > 0xffff) {
+        return false;
+    }
+    uint32_t allocate = GMIN(0xffff, GMAX(entries, ctx->offsetsAllocated + (ctx->offsetsAllocated/2) + 8));
+    uint16_t *offsets = ctx->offsets;
+    err_t err;
+    if (offsets == NULL) {
+        err = arrayMemAlloc(ctx, allocate * sizeof(uint16_t), &offsets);
+    } else {
+        err = arrayMemRealloc(ctx, ctx->offsetsAllocated * sizeof(uint16_t), allocate * sizeof(uint16_t), &offsets);
+    }
+    if (err) {
+        return false;
+    }
+    ctx->offsets = offsets;
+    ctx->offsetsAllocated = (uint16_t) allocate;
+    return true;
+}
+
+// Rebuild a string array's offset index with a single scan of its contents.  If the index
+// can't be built, the array falls back to scanning for good rather than retrying the
+// allocation on every access.
+static bool arrayIndexRebuild(array *ctx)
+{
+    ctx->offsetsCount = 0;
+    if (ctx->length > 0xffff || !arrayIndexGrow(ctx, ctx->count)) {
+        ctx->indexed = false;
+        if (ctx->offsets != NULL) {
+            arrayMemFree(ctx, ctx->offsets);
+            ctx->offsets = NULL;
+            ctx->offsetsAllocated = 0;
+        }
+        return false;
+    }
+    char *address = ctx->address;
+    uint32_t offset = 0;
+    for (int i=0; i<ctx->count; i++) {
+        ctx->offsets[i] = (uint16_t) offset;
+        offset += strlen(&address[offset])+1;
+    }
+    ctx->offsetsCount = ctx->count;
+    return true;
+}
+
+// See if a string array's offset index is usable as-is
+#define arrayIndexValid(ctx) ((ctx)->offsets != NULL && (ctx)->offsetsCount == (ctx)->count)
+
+// Maintain the offset index of a string array after an entry has been appended at the specified offset
+static void arrayIndexAppended(array *ctx, uint32_t offset)
+{
+    uint16_t i = ctx->count-1;
+    if (ctx->offsets == NULL || ctx->offsetsCount != i) {
+        return;
+    }
+    if (offset > 0xffff || !arrayIndexGrow(ctx, ctx->count)) {
+        ctx->offsetsCount = 0;
+        return;
+    }
+    ctx->offsets[i] = (uint16_t) offset;
+    ctx->offsetsCount = ctx->count;
+}
+
+// Enable the offset index for a string array, so that arrayEntry() is constant-time rather
+// than scanning from the last entry accessed.  This costs 2 bytes per entry, and the index
+// is dropped (falling back to scanning) for string arrays with more than 64KB of content or
+// if there isn't memory for it.
+err_t arrayIndexStrings(array *ctx)
+{
+    if (ctx->size != 0) {
+        return errF("array index is only used by string arrays");
+    }
+    ctx->indexed = true;
+    if (ctx->count > 0) {
+        arrayIndexRebuild(ctx);
+    }
+    return errNone;
+}
+
 // Insert an entry into an array at the specified idnex
 err_t arrayInsert(array *ctx, uint16_t i, void *data)
 {
@@ -31,14 +255,10 @@ err_t arrayInsert(array *ctx, uint16_t i, void *data)
 
     // Reallocate if we must grow
     if (datalen > (ctx->allocated - ctx->length)) {
-        uint32_t alloclen = GMAX(ctx->chunksize, datalen);
-        err_t err = memRealloc(ctx->allocated, ctx->allocated + alloclen, &ctx->address);
+        err_t err = arrayGrowTo(ctx, ctx->allocated + arrayGrowthLen(ctx, datalen));
         if (err) {
             return err;
         }
-        ctx->allocated = ctx->allocated + alloclen;
-        ctx->cachedIndex = 0;
-        ctx->cachedAddress = ctx->address;
     }
 
     // Copy everything upward, in a way that works for both fixed and string arrays
@@ -47,6 +267,17 @@ err_t arrayInsert(array *ctx, uint16_t i, void *data)
     uint32_t len = ((uint8_t *)ctx->address+ctx->length) - from;
     memmove(to, from, len);
 
+    // Shift the offset index upward, noting that the new entry occupies the old entry's offset
+    bool indexValid = false;
+    if (ctx->size == 0 && arrayIndexValid(ctx)) {
+        if (ctx->length + datalen <= 0xffff && arrayIndexGrow(ctx, ctx->count+1)) {
+            for (int j=ctx->count; j>i; j--) {
+                ctx->offsets[j] = ctx->offsets[j-1] + (uint16_t) datalen;
+            }
+            indexValid = true;
+        }
+    }
+
     // Copy the data
     if (data == NULL) {
         memset(from, 0, datalen);
@@ -57,6 +288,7 @@ err_t arrayInsert(array *ctx, uint16_t i, void *data)
     // Update the entries, in a way that works for both fixed and string arrays
     ctx->length += datalen;
     ctx->count++;
+    ctx->offsetsCount = indexValid ? ctx->count : 0;
 
     // Reset the cache
     ctx->cachedIndex = 0;
@@ -88,9 +320,19 @@ void arrayRemove(array *ctx, uint16_t i)
         memmove(to, from, len);
     }
 
+    // Shift the offset index downward
+    bool indexValid = false;
+    if (ctx->size == 0 && arrayIndexValid(ctx)) {
+        for (int j=i; j<ctx->count-1; j++) {
+            ctx->offsets[j] = ctx->offsets[j+1] - (uint16_t) size;
+        }
+        indexValid = true;
+    }
+
     // Update the length and count
     ctx->length -= size;
     ctx->count--;
+    ctx->offsetsCount = indexValid ? ctx->count : 0;
 
     // Reset the cache
     ctx->cachedIndex = 0;
@@ -121,10 +363,11 @@ err_t arraySet(array *ctx, int index, void *data)
     return errNone;
 }
 
-// Shrink an array to just what's needed
+// Shrink an array to just what's needed.  Arena arrays are left alone because their
+// memory is reclaimed all at once when the arena is reset.
 void arrayShrink(array *ctx)
 {
-    if (ctx->allocated != ctx->length) {
+    if (ctx->arena == NULL && ctx->allocated != ctx->length) {
         void *newData;
         err_t err = memDup(ctx->address, ctx->length, &newData);
         if (err) {
@@ -140,7 +383,7 @@ void arrayShrink(array *ctx)
 }
 
 // Append bytes to the end of a growable object
-err_t arrayAppendBytes(array *ctx, void *data, uint16_t datalen)
+err_t arrayAppendBytes(array *ctx, void *data, uint32_t datalen)
 {
     // Note that size == 0 has a very special meaning in arrayAppend and
     // if we set size to 0 it would append 1 null byte instead (!), and so
@@ -148,8 +391,10 @@ err_t arrayAppendBytes(array *ctx, void *data, uint16_t datalen)
     if (datalen == 0) {
         return errNone;
     }
-    ctx->size = datalen;
-    return arrayAppend(ctx, data);
+    // The entry size only needs to be nonzero so that subsequent appends aren't treated
+    // as strings, so lengths that won't fit in it are recorded as single bytes.
+    ctx->size = (datalen > 0xffff) ? 1 : (uint16_t) datalen;
+    return arrayAppendLen(ctx, data, datalen);
 }
 
 // Append a string as bytes to the end of a growable object, always leaving
@@ -183,10 +428,8 @@ err_t arrayAppendStringTerminate(array *ctx)
 err_t arrayAppend(array *ctx, void *data)
 {
 
-    err_t err;
-
     // If no entry size, it's a string array
-    uint16_t datalen = ctx->size;
+    uint32_t datalen = ctx->size;
     if (datalen == 0) {
         if (data == NULL) {
             datalen = 1;
@@ -195,50 +438,25 @@ err_t arrayAppend(array *ctx, void *data)
         }
     }
 
-    // Default the chunk size
-    if (ctx->chunksize == 0) {
-        ctx->chunksize = 512;
+    // Append, maintaining the offset index of string arrays
+    err_t err = arrayAppendLen(ctx, data, datalen);
+    if (!err && ctx->size == 0 && ctx->indexed) {
+        arrayIndexAppended(ctx, ctx->length - datalen);
     }
+    return err;
 
-    // If this is the first allocation, assume that it will be small
-    uint16_t chunksize = ctx->chunksize;
-    if (ctx->address == NULL) {
-        chunksize /= 2;
-    }
-    if (ctx->allocated >= (4*chunksize)) {
-        chunksize = 2*chunksize;
-    }
+}
 
-    // Determine alloc length so as to ensure that there will be room after alloc
-    uint32_t alloclen = GMAX(chunksize, datalen);
+// Append an entry of the specified length, growing the buffer if necessary
+static err_t arrayAppendLen(array *ctx, void *data, uint32_t datalen)
+{
 
     // Allocate or grow the buffer
-    if (ctx->address == NULL) {
-        uint8_t *initial;
-        err = memAlloc(alloclen, &initial);
-        if (err) {
-            return err;
-        }
-        ctx->address = initial;
-        ctx->allocated = alloclen;
-        ctx->cachedIndex = 0;
-        ctx->cachedAddress = ctx->address;
-    } else if (datalen > (ctx->allocated - ctx->length)) {
-        uint32_t cachedOffset = (uint32_t) ((uint8_t *)ctx->cachedAddress - (uint8_t *)ctx->address);
-        if (ctx->cachedAddress == NULL) {
-            cachedOffset = 0;
-        }
-        err_t err = memRealloc(ctx->allocated, ctx->allocated + alloclen, &ctx->address);
+    if (ctx->address == NULL || datalen > (ctx->allocated - ctx->length)) {
+        err_t err = arrayGrowTo(ctx, ctx->allocated + arrayGrowthLen(ctx, datalen));
         if (err) {
             return err;
         }
-        ctx->allocated = ctx->allocated + alloclen;
-        if (cachedOffset == 0) {
-            ctx->cachedAddress = ctx->address;
-            ctx->cachedIndex = 0;
-        } else {
-            ctx->cachedAddress = (uint8_t *) ctx->address + cachedOffset;
-        }
     }
 
     // Append the new stuff
@@ -282,6 +500,7 @@ void arrayClear(array *ctx)
     // Set the count to 0 indicating that it's cleared
     ctx->count = 0;
     ctx->length = 0;
+    ctx->offsetsCount = 0;
     ctx->cachedIndex = 0;
     ctx->cachedAddress = ctx->address;
 }
@@ -296,10 +515,17 @@ void arrayReset(array *ctx)
     // Free the buffer containing all entries
     ctx->allocated = 0;
     if (ctx->address != NULL) {
-        memFree(ctx->address);
+        arrayMemFree(ctx, ctx->address);
         ctx->address = NULL;
     }
 
+    // Free the offset index, which will be rebuilt if needed
+    if (ctx->offsets != NULL) {
+        arrayMemFree(ctx, ctx->offsets);
+        ctx->offsets = NULL;
+        ctx->offsetsAllocated = 0;
+    }
+
 }
 
 // Allocate an array with either a fixed size, or a string array if fixedsize==0
@@ -317,7 +543,28 @@ err_t arrayAlloc(uint16_t fixedsize, arrayEntryReset_t entryReset, array **ctx)
     return errNone;
 }
 
-// Duplicate an array
+// Allocate an array whose header and contents both come from an arena, such that freeing
+// it is optional because everything is released when the arena is reset.  If the arena has no
+// backing store, the array is allocated on the heap as usual.
+err_t arrayAllocArena(memArena *arena, uint16_t fixedsize, arrayEntryReset_t entryReset, array **ctx)
+{
+    if (arena == NULL || arena->base == NULL) {
+        return arrayAlloc(fixedsize, entryReset, ctx);
+    }
+    err_t err;
+    array *new;
+    err = memArenaAlloc(arena, sizeof(array), &new);
+    if (err) {
+        return err;
+    }
+    new->size = fixedsize;
+    new->resetFn = entryReset;
+    new->arena = arena;
+    *ctx = new;
+    return errNone;
+}
+
+// Duplicate an array, always onto the heap even if the original is in an arena
 err_t arrayDup(array *ctx, array **dupCtx)
 {
     err_t err;
@@ -327,6 +574,10 @@ err_t arrayDup(array *ctx, array **dupCtx)
     if (err) {
         return err;
     }
+    newCtx->arena = NULL;
+    newCtx->offsets = NULL;
+    newCtx->offsetsCount = 0;
+    newCtx->offsetsAllocated = 0;
 
     if (ctx->address != NULL) {
 
@@ -352,14 +603,19 @@ err_t arrayDup(array *ctx, array **dupCtx)
 void arrayFree(array *ctx)
 {
     arrayReset(ctx);
-    memFree(ctx);
+    arrayMemFree(ctx, ctx);
 }
 
-// Free an array while detaching its object
+// Free an array while detaching its object.  Note that for arena arrays the object remains
+// owned by the arena, and is only valid until the arena is reset, unless it outgrew the arena
+// and moved to the heap, which memArenaOwns() tells.
 void *arrayFreeDetach(array *ctx)
 {
     void *p = ctx->address;
-    memFree(ctx);
+    if (ctx->offsets != NULL) {
+        arrayMemFree(ctx, ctx->offsets);
+    }
+    arrayMemFree(ctx, ctx);
     return p;
 }
 
@@ -367,45 +623,255 @@ void *arrayFreeDetach(array *ctx)
 void *arrayFreeDetachDup(array *ctx)
 {
     void *p = ctx->address;
+    if (ctx->offsets != NULL) {
+        arrayMemFree(ctx, ctx->offsets);
+    }
     if (p != NULL) {
         void *q;
         if (memDup(p, ctx->length, &q) == errNone) {
-            memFree(p);
+            arrayMemFree(ctx, p);
             p = q;
+        } else if (ctx->arena != NULL) {
+            p = NULL;
         }
     }
-    memFree(ctx);
+    arrayMemFree(ctx, ctx);
     return p;
 }
 
-// Sort an array
-err_t arraySort(array *ctx)
+// Sorting parameters.  Runs shorter than the threshold are insertion-sorted before merging,
+// and small arrays and entries are sorted using buffers on the stack rather than the heap.
+#define ARRAY_SORT_INSERTION_RUN    12
+#define ARRAY_SORT_STACK_ENTRIES    32
+#define ARRAY_SORT_STACK_ENTRYSIZE  32
+
+// Address of an entry being sorted, given the offsets of string entries
+#define arraySortEntry(ctx, offsets, i) ((ctx)->size ? ((uint8_t *)(ctx)->address) + ((uint32_t)(ctx)->size * (i)) : ((uint8_t *)(ctx)->address) + (offsets)[i])
+
+// Stable bottom-up merge sort of entry indices, with insertion sort for short runs
+static void arraySortIndices(array *ctx, uint32_t *offsets, uint16_t *index, uint16_t *scratch)
+{
+    uint32_t n = ctx->count;
+
+    // Insertion-sort each short run
+    for (uint32_t a=0; a<n; a+=ARRAY_SORT_INSERTION_RUN) {
+        uint32_t b = GMIN(a+ARRAY_SORT_INSERTION_RUN, n);
+        for (uint32_t i=a+1; i<b; i++) {
+            uint16_t v = index[i];
+            void *ventry = arraySortEntry(ctx, offsets, v);
+            uint32_t j = i;
+            while (j > a && ctx->isLessFn(ventry, arraySortEntry(ctx, offsets, index[j-1]))) {
+                index[j] = index[j-1];
+                j--;
+            }
+            index[j] = v;
+        }
+    }
+
+    // Merge runs of doubling width, alternating between the two buffers
+    uint16_t *src = index;
+    uint16_t *dst = scratch;
+    for (uint32_t width=ARRAY_SORT_INSERTION_RUN; width<n; width*=2) {
+        for (uint32_t a=0; a<n; a+=2*width) {
+            uint32_t m = GMIN(a+width, n);
+            uint32_t b = GMIN(a+2*width, n);
+            uint32_t i = a, j = m, k = a;
+            while (i < m && j < b) {
+                if (ctx->isLessFn(arraySortEntry(ctx, offsets, src[j]), arraySortEntry(ctx, offsets, src[i]))) {
+                    dst[k++] = src[j++];
+                } else {
+                    dst[k++] = src[i++];
+                }
+            }
+            while (i < m) {
+                dst[k++] = src[i++];
+            }
+            while (j < b) {
+                dst[k++] = src[j++];
+            }
+        }
+        uint16_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != index) {
+        memcpy(index, src, n * sizeof(uint16_t));
+    }
+
+}
+
+// Locate the entries of a string array with a single scan, for random access while sorting
+static err_t arraySortOffsets(array *ctx, uint32_t **offsets)
+{
+    *offsets = NULL;
+    if (ctx->size != 0) {
+        return errNone;
+    }
+    err_t err = memAlloc(ctx->count * sizeof(uint32_t), offsets);
+    if (err) {
+        return err;
+    }
+    char *address = ctx->address;
+    uint32_t offset = 0;
+    for (int i=0; i<ctx->count; i++) {
+        (*offsets)[i] = offset;
+        offset += strlen(&address[offset])+1;
+    }
+    return errNone;
+}
+
+// Compute the sorted order of entries, using a stack buffer if the array is small enough
+static err_t arraySortOrder(array *ctx, uint32_t *offsets, uint16_t *index)
+{
+    uint16_t stackScratch[ARRAY_SORT_STACK_ENTRIES];
+    uint16_t *scratch = stackScratch;
+    if (ctx->count > ARRAY_SORT_STACK_ENTRIES) {
+        err_t err = memAlloc(ctx->count * sizeof(uint16_t), &scratch);
+        if (err) {
+            return err;
+        }
+    }
+    for (int i=0; i<ctx->count; i++) {
+        index[i] = i;
+    }
+    arraySortIndices(ctx, offsets, index, scratch);
+    if (scratch != stackScratch) {
+        memFree(scratch);
+    }
+    return errNone;
+}
+
+// Compute the sorted order of an array's entries without moving them, so that index[i] is
+// the index of the i'th entry in sorted order.  The index buffer must have room for one
+// uint16_t per entry.  This is useful when entries are large, or when the original order
+// must be retained.  The sort is stable.
+err_t arraySortIndex(array *ctx, uint16_t *index)
 {
     err_t err;
-    void *l, *r, *tmp;
     if (ctx->address == NULL || ctx->count == 0) {
         return errNone;
     }
     if (ctx->isLessFn == NULL) {
         return errF("no sort method specified");
     }
-    err = memAlloc(ctx->size, &tmp);
+    uint32_t *offsets;
+    err = arraySortOffsets(ctx, &offsets);
     if (err) {
         return err;
     }
-    int a = 0;
-    int b = ctx->count;
-    for (int i = a + 1; i < b; i++) {
-        for (int j = i; j > a && ctx->isLessFn(l=arrayEntry(ctx, j), r=arrayEntry(ctx, j-1)); j--) {
-            memcpy(tmp, l, ctx->size);
-            memcpy(l, r, ctx->size);
-            memcpy(r, tmp, ctx->size);
+    err = arraySortOrder(ctx, offsets, index);
+    if (offsets != NULL) {
+        memFree(offsets);
+    }
+    return err;
+}
+
+// Rearrange a fixed-size array's entries into the order specified by an index, by following
+// the cycles of the permutation so that each entry is moved only once.  The index is
+// destroyed in the process.
+static err_t arrayPermute(array *ctx, uint16_t *index)
+{
+    err_t err;
+    uint8_t stackTmp[ARRAY_SORT_STACK_ENTRYSIZE];
+    uint8_t *tmp = stackTmp;
+    if (ctx->size > sizeof(stackTmp)) {
+        err = memAlloc(ctx->size, &tmp);
+        if (err) {
+            return err;
+        }
+    }
+    uint8_t *address = ctx->address;
+    uint32_t size = ctx->size;
+    for (uint32_t i=0; i<ctx->count; i++) {
+        if (index[i] == i) {
+            continue;
+        }
+        memcpy(tmp, &address[i*size], size);
+        uint32_t j = i;
+        while (index[j] != i) {
+            uint32_t k = index[j];
+            memcpy(&address[j*size], &address[k*size], size);
+            index[j] = j;
+            j = k;
         }
+        memcpy(&address[j*size], tmp, size);
+        index[j] = j;
+    }
+    if (tmp != stackTmp) {
+        memFree(tmp);
+    }
+    return errNone;
+}
+
+// Rearrange a string array's entries into the order specified by an index
+static err_t arrayPermuteStrings(array *ctx, uint32_t *offsets, uint16_t *index)
+{
+    err_t err;
+    char *sorted;
+    err = arrayMemAlloc(ctx, ctx->length, &sorted);
+    if (err) {
+        return err;
+    }
+    uint32_t offset = 0;
+    for (int i=0; i<ctx->count; i++) {
+        char *entry = ((char *)ctx->address) + offsets[index[i]];
+        uint32_t entryLen = strlen(entry)+1;
+        memcpy(&sorted[offset], entry, entryLen);
+        offset += entryLen;
+    }
+    memcpy(ctx->address, sorted, ctx->length);
+    arrayMemFree(ctx, sorted);
+    ctx->cachedIndex = 0;
+    ctx->cachedAddress = ctx->address;
+    if (ctx->indexed) {
+        arrayIndexRebuild(ctx);
     }
-    memFree(tmp);
     return errNone;
 }
 
+// Sort an array in place, in O(n log n) time.  The sort is stable.
+err_t arraySort(array *ctx)
+{
+    err_t err;
+    if (ctx->address == NULL || ctx->count == 0) {
+        return errNone;
+    }
+    if (ctx->isLessFn == NULL) {
+        return errF("no sort method specified");
+    }
+
+    // Compute the sorted order
+    uint16_t stackIndex[ARRAY_SORT_STACK_ENTRIES];
+    uint16_t *index = stackIndex;
+    if (ctx->count > ARRAY_SORT_STACK_ENTRIES) {
+        err = memAlloc(ctx->count * sizeof(uint16_t), &index);
+        if (err) {
+            return err;
+        }
+    }
+    uint32_t *offsets;
+    err = arraySortOffsets(ctx, &offsets);
+    if (!err) {
+        err = arraySortOrder(ctx, offsets, index);
+
+        // Move the entries into that order
+        if (!err) {
+            if (ctx->size) {
+                err = arrayPermute(ctx, index);
+            } else {
+                err = arrayPermuteStrings(ctx, offsets, index);
+            }
+        }
+        if (offsets != NULL) {
+            memFree(offsets);
+        }
+    }
+
+    if (index != stackIndex) {
+        memFree(index);
+    }
+    return err;
+}
 
 // Array index
 void *arrayEntry(array *ctx, int index)
@@ -422,6 +888,13 @@ void *arrayEntry(array *ctx, int index)
         return (address + (ctx->size * index));
     }
 
+    // Use the offset index if there is one, rebuilding it if it has gone stale
+    if (ctx->indexed) {
+        if (arrayIndexValid(ctx) || arrayIndexRebuild(ctx)) {
+            return ((char *)ctx->address) + ctx->offsets[index];
+        }
+    }
+
     // If going backward, reset the cache
     if (index < ctx->cachedIndex) {
         ctx->cachedIndex = 0;
@@ -441,6 +914,189 @@ void *arrayEntry(array *ctx, int index)
 
 }
 
+// Hash a map name, folding case if the map's index is case-insensitive
+static uint32_t arrayMapHash(const char *name, bool caseFold)
+{
+    uint32_t hash = 2166136261UL;
+    for (; *name != '\0'; name++) {
+        char ch = *name;
+        if (caseFold && ch >= 'A' && ch <= 'Z') {
+            ch += 'a'-'A';
+        }
+        hash = (hash ^ (uint8_t) ch) * 16777619UL;
+    }
+    return hash;
+}
+
+// Discard a map's hash index, which will be rebuilt on the next lookup
+static void arrayMapHashDiscard(arrayMap *map)
+{
+    if (map->hashTable != NULL) {
+        memFree(map->hashTable);
+        map->hashTable = NULL;
+        map->hashSlots = 0;
+    }
+}
+
+// Place an entry into a map's hash index, using linear probing
+static void arrayMapHashInsert(arrayMap *map, uint16_t i)
+{
+    uint32_t mask = map->hashSlots-1;
+    uint32_t slot = arrayMapHash(arrayEntry(map->name, i), map->hashCaseFold) & mask;
+    while (map->hashTable[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    map->hashTable[slot] = i+1;
+}
+
+// Rebuild a map's hash index sized for its current entries, keeping the load below 75%
+static bool arrayMapHashRebuild(arrayMap *map)
+{
+    arrayMapHashDiscard(map);
+    if (map->count > 0x3fff) {
+        return false;
+    }
+    uint32_t slots = 16;
+    while (slots < (((uint32_t)map->count * 4) / 3) + 1) {
+        slots *= 2;
+    }
+    if (memAlloc(slots * sizeof(uint16_t), &map->hashTable) != errNone) {
+        map->hashTable = NULL;
+        return false;
+    }
+    map->hashSlots = slots;
+    for (int i=0; i<map->count; i++) {
+        arrayMapHashInsert(map, i);
+    }
+    return true;
+}
+
+// Remove an entry from a map's hash index, and renumber the entries that follow it.  This must
+// be called before the entry is removed from the name array because it re-hashes neighbors.
+static void arrayMapHashRemove(arrayMap *map, uint16_t i)
+{
+    if (map->hashTable == NULL) {
+        return;
+    }
+
+    // Find the slot holding this entry
+    uint32_t mask = map->hashSlots-1;
+    uint32_t hole = arrayMapHash(arrayEntry(map->name, i), map->hashCaseFold) & mask;
+    while (map->hashTable[hole] != i+1) {
+        if (map->hashTable[hole] == 0) {
+            arrayMapHashDiscard(map);
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+
+    // Backward-shift deletion, so that no tombstones are needed
+    map->hashTable[hole] = 0;
+    uint32_t j = hole;
+    while (true) {
+        j = (j + 1) & mask;
+        if (map->hashTable[j] == 0) {
+            break;
+        }
+        uint32_t home = arrayMapHash(arrayEntry(map->name, map->hashTable[j]-1), map->hashCaseFold) & mask;
+        bool movable = (j > hole) ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (movable) {
+            map->hashTable[hole] = map->hashTable[j];
+            map->hashTable[j] = 0;
+            hole = j;
+        }
+    }
+
+    // Entries after this one will all move down by one
+    for (uint32_t slot=0; slot<map->hashSlots; slot++) {
+        if (map->hashTable[slot] > i+1) {
+            map->hashTable[slot]--;
+        }
+    }
+
+}
+
+// Maintain a map's hash index after an entry has been appended
+static void arrayMapHashAppended(arrayMap *map, uint16_t i)
+{
+    if (map->hashTable == NULL) {
+        return;
+    }
+    if (((uint32_t)map->count * 4) > (map->hashSlots * 3)) {
+        arrayMapHashDiscard(map);
+        return;
+    }
+    arrayMapHashInsert(map, i);
+}
+
+// Enable a hash index on a map's names, so that lookups don't compare every name.  If the
+// index is case-insensitive it serves both kinds of lookup; if it is case-sensitive,
+// case-insensitive lookups fall back to comparing every name.
+err_t arrayMapIndex(arrayMap *map, bool caseSensitive)
+{
+    map->hashed = true;
+    map->hashCaseFold = !caseSensitive;
+    if (!arrayMapHashRebuild(map)) {
+        return errF("cannot index map " ERR_MEM_ALLOC);
+    }
+    return errNone;
+}
+
+// Find the index of a name in a map, or -1 if it isn't there
+static int arrayMapFind(arrayMap *map, bool caseSensitive, char *name)
+{
+    uint16_t namestrlen = strlen(name)+1;
+
+    // Use the hash index if it is appropriate for this kind of lookup
+    if (map->hashed && (caseSensitive || map->hashCaseFold)) {
+        if (map->hashTable != NULL || arrayMapHashRebuild(map)) {
+            uint32_t mask = map->hashSlots-1;
+            uint32_t slot = arrayMapHash(name, map->hashCaseFold) & mask;
+            int found = -1;
+            while (map->hashTable[slot] != 0) {
+                int i = map->hashTable[slot]-1;
+                char *entryName = arrayEntry(map->name, i);
+                if (caseSensitive ? memeql(name, entryName, namestrlen) : memeqlCI(name, entryName, namestrlen)) {
+                    // Names differing only in case share a chain, so keep the first as a scan would
+                    if (caseSensitive) {
+                        return i;
+                    }
+                    if (found < 0 || i < found) {
+                        found = i;
+                    }
+                }
+                slot = (slot + 1) & mask;
+            }
+            return found;
+        }
+    }
+
+    // Compare every name
+    for (int i=0; i<map->name->count; i++) {
+        char *entryName = arrayEntry(map->name, i);
+        bool match;
+        if (caseSensitive) {
+            match = memeql(name, entryName, namestrlen);
+        } else {
+            match = memeqlCI(name, entryName, namestrlen);
+        }
+        if (match) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Remove the entry at the specified index of a map
+static void arrayMapRemoveEntry(arrayMap *map, int i)
+{
+    arrayMapHashRemove(map, i);
+    arrayRemove(map->name, i);
+    arrayRemove(map->value1, i);
+    arrayRemove(map->value2, i);
+    map->count = map->name->count;
+}
+
 // Free entries in a map array without shrinking the allocated objects
 void arrayMapClear(arrayMap *map)
 {
@@ -448,6 +1104,9 @@ void arrayMapClear(arrayMap *map)
     arrayClear(map->value2);
     arrayClear(map->name);
     map->count = 0;
+    if (map->hashTable != NULL) {
+        memset(map->hashTable, 0, map->hashSlots * sizeof(uint16_t));
+    }
 }
 
 // Allocate a map array
@@ -477,7 +1136,7 @@ err_t arrayMapAlloc(uint16_t fixedsize1, arrayEntryReset_t entryReset1, uint16_t
         return err;
     }
 
-    // Allocate the name map
+    // Allocate the name map, which is indexed because names are looked up by position
     err = arrayAlloc(0, NULL, &map->name);
     if (err) {
         arrayFree(map->value1);
@@ -485,6 +1144,20 @@ err_t arrayMapAlloc(uint16_t fixedsize1, arrayEntryReset_t entryReset1, uint16_t
         memFree(map);
         return err;
     }
+    err = arrayIndexStrings(map->name);
+    if (!err && fixedsize1 == 0) {
+        err = arrayIndexStrings(map->value1);
+    }
+    if (!err && fixedsize2 == 0) {
+        err = arrayIndexStrings(map->value2);
+    }
+    if (err) {
+        arrayFree(map->name);
+        arrayFree(map->value1);
+        arrayFree(map->value2);
+        memFree(map);
+        return err;
+    }
 
     // Done
     *ctx = map;
@@ -502,6 +1175,8 @@ err_t arrayMapDup(arrayMap *in, arrayMap **out)
     if (err) {
         return err;
     }
+    new->hashTable = NULL;
+    new->hashSlots = 0;
 
     err = arrayDup(in->name, &new->name);
     if (err) {
@@ -528,12 +1203,13 @@ err_t arrayMapDup(arrayMap *in, arrayMap **out)
     return errNone;
 }
 
-// Shrink a map array
+// Shrink a map array, letting the hash index be rebuilt to fit on next lookup
 void arrayMapShrink(arrayMap *map)
 {
     arrayShrink(map->value1);
     arrayShrink(map->value2);
     arrayShrink(map->name);
+    arrayMapHashDiscard(map);
 }
 
 // Free a map array
@@ -542,6 +1218,7 @@ void arrayMapFree(arrayMap *map)
     arrayFree(map->value1);
     arrayFree(map->value2);
     arrayFree(map->name);
+    arrayMapHashDiscard(map);
     memFree(map);
 }
 
@@ -551,6 +1228,7 @@ void arrayMapFreeDetachValue(arrayMap *map, array **retValue1, array **retValue2
     *retValue1 = map->value1;
     *retValue2 = map->value2;
     arrayFree(map->name);
+    arrayMapHashDiscard(map);
     memFree(map);
 }
 
@@ -559,22 +1237,9 @@ err_t arrayMapRemove(arrayMap *map, bool caseSensitive, char *name)
 {
 
     // Remove if it's found
-    uint16_t namestrlen = strlen(name)+1;
-    for (int i=0; i<map->name->count; i++) {
-        char *entryName = arrayEntry(map->name, i);
-        bool match;
-        if (caseSensitive) {
-            match = memeql(name, entryName, namestrlen);
-        } else {
-            match = memeqlCI(name, entryName, namestrlen);
-        }
-        if (match) {
-            arrayRemove(map->name, i);
-            arrayRemove(map->value1, i);
-            arrayRemove(map->value2, i);
-            map->count = map->name->count;
-            break;
-        }
+    int i = arrayMapFind(map, caseSensitive, name);
+    if (i >= 0) {
+        arrayMapRemoveEntry(map, i);
     }
 
     // Done
@@ -594,22 +1259,9 @@ err_t arrayMapSet(arrayMap *map, bool caseSensitive, char *name, void *value1, v
     }
 
     // Remove if it's found
-    uint16_t namestrlen = strlen(name)+1;
-    for (int i=0; i<map->name->count; i++) {
-        char *entryName = arrayEntry(map->name, i);
-        bool match;
-        if (caseSensitive) {
-            match = memeql(name, entryName, namestrlen);
-        } else {
-            match = memeqlCI(name, entryName, namestrlen);
-        }
-        if (match) {
-            arrayRemove(map->name, i);
-            arrayRemove(map->value1, i);
-            arrayRemove(map->value2, i);
-            map->count = map->name->count;
-            break;
-        }
+    int i = arrayMapFind(map, caseSensitive, name);
+    if (i >= 0) {
+        arrayMapRemoveEntry(map, i);
     }
 
     // Exit if both values are NULL, which means that we're removing it
@@ -635,6 +1287,7 @@ err_t arrayMapSet(arrayMap *map, bool caseSensitive, char *name, void *value1, v
         return err;
     }
     map->count = map->name->count;
+    arrayMapHashAppended(map, newEntry);
 
     // Done
     return errNone;
@@ -648,26 +1301,17 @@ bool arrayMapGet(arrayMap *map, bool caseSensitive, char *name, void *value1, vo
         debugSoftPanic("invalid map");
         return false;
     }
-    uint16_t namestrlen = strlen(name)+1;
-    for (int i=0; i<map->name->count; i++) {
-        char *entryName = arrayEntry(map->name, i);
-        bool match;
-        if (caseSensitive) {
-            match = memeql(name, entryName, namestrlen);
-        } else {
-            match = memeqlCI(name, entryName, namestrlen);
-        }
-        if (match) {
-            if (value1 != NULL) {
-                *((void **)value1) = arrayEntry(map->value1, i);
-            }
-            if (value2 != NULL) {
-                *((void **)value2) = arrayEntry(map->value2, i);
-            }
-            return true;
-        }
+    int i = arrayMapFind(map, caseSensitive, name);
+    if (i < 0) {
+        return false;
     }
-    return false;
+    if (value1 != NULL) {
+        *((void **)value1) = arrayEntry(map->value1, i);
+    }
+    if (value2 != NULL) {
+        *((void **)value2) = arrayEntry(map->value2, i);
+    }
+    return true;
 }
 
 // Get the value of an array entry by index
@@ -0,0 +1,19 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "global.h"
+
+// Days since 1970-01-01 of a proleptic Gregorian date, in constant time rather than by looping
+// over the years, because the RTC is converted on every entry to and exit from STOP2.  Years are
+// counted from March so that the leap day falls at the end of the year, within a 400-year era of
+// 146097 days.
+int64_t civilDaysFromDate(int year, int mon1, int day1)
+{
+    int y = year - (mon1 <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y-399) / 400;
+    int yoe = y - (era * 400);                                          // [0, 399]
+    int doy = ((153 * (mon1 > 2 ? mon1-3 : mon1+9)) + 2) / 5 + day1-1;  // [0, 365]
+    int doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;              // [0, 146096]
+    return ((int64_t) era * 146097) + doe - 719468;
+}
@@ -0,0 +1,88 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "global.h"
+#include "coro.h"
+
+// Job that steps a coroutine each time it's woken, until it finishes
+STATIC void coroRun(void *arg)
+{
+    coro *c = (coro *) arg;
+    if (c->done) {
+        return;
+    }
+    if (c->func(c)) {
+        coroDisarm(c);
+        c->done = true;
+    }
+}
+
+// Start a coroutine, which must not already be running, at the given job priority
+void coroStart(coro *c, coroFunc func, void *arg, uint32_t priority)
+{
+    jobCancel(&c->job);
+    jobInit(&c->job, coroRun, c, priority);
+    c->line = 0;
+    c->func = func;
+    c->arg = arg;
+    c->deadlineMs = 0;
+    c->timedOut = false;
+    c->done = false;
+    jobPost(&c->job);
+}
+
+// Wake a coroutine so that it re-evaluates what it's awaiting
+void coroWake(coro *c)
+{
+    jobPost(&c->job);
+}
+
+// Wake a coroutine from an ISR, typically an I/O completion callback
+void coroWakeFromISR(coro *c)
+{
+    jobPostFromISR(&c->job);
+}
+
+// See whether a coroutine has finished
+bool coroIsDone(coro *c)
+{
+    return c->done;
+}
+
+// See whether the most recent CORO_AWAIT_TIMEOUT gave up waiting
+bool coroTimedOut(coro *c)
+{
+    return c->timedOut;
+}
+
+// Arm the timeout of an await, by which the coroutine is woken if nothing else wakes it
+void coroArm(coro *c, uint32_t ms)
+{
+    c->deadlineMs = timerMs() + ms;
+    c->timedOut = false;
+    jobPostDelayed(&c->job, ms);
+}
+
+// See whether the timeout of an await has expired.  The timer server and timerMs() don't share
+// a clock, so if the timer fired a little early it is re-armed for whatever remains.
+bool coroExpired(coro *c)
+{
+    int64_t remainingMs = c->deadlineMs - timerMs();
+    if (remainingMs <= 0) {
+        return true;
+    }
+    if (!jobIsPending(&c->job)) {
+        jobPostDelayed(&c->job, (uint32_t) remainingMs);
+    }
+    return false;
+}
+
+// Disarm the timeout of an await that has finished waiting
+void coroDisarm(coro *c)
+{
+    if (c->job.timerCreated) {
+        UTIL_TIMER_Stop(&c->job.timer);
+    }
+    c->deadlineMs = 0;
+}
@@ -0,0 +1,71 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include "job.h"
+
+// Stackless coroutines, for I/O sequences that would otherwise hold a task while they spin
+// waiting for completion.  A coroutine is a function that is re-entered from the top each time
+// it's woken, resuming at the await where it left off, so its locals do NOT survive an await and
+// anything it needs across one must live in the coro or in what its arg points to.  Awaits may
+// not be placed inside a switch statement of the coroutine's own.  Coroutines are run as jobs on
+// the job task, so many I/O sequences can be in flight with no stack of their own.  ISR
+// completion callbacks wake them with coroWakeFromISR(), after which the awaited condition is
+// re-evaluated, so conditions must be cheap and free of side effects.  Start I/O outside of
+// awaits, and await its completion.  MY_I2C_UpdateRegisterCoro() in i2c.c is a complete example.
+//
+//   bool sensorRead(coro *c)
+//   {
+//       sensorState *s = c->arg;
+//       CORO_BEGIN(c);
+//       while (!MY_I2C_ReadRegisterAsync(&hi2c1, SENSOR_ADDR, SENSOR_REG, s->buf, 2, c)) {
+//           CORO_SLEEP(c, 5);
+//       }
+//       CORO_AWAIT_TIMEOUT(c, !MY_I2C_Busy(&hi2c1), 100);
+//       if (coroTimedOut(c) || MY_I2C_Failed(&hi2c1)) {
+//           CORO_EXIT(c);
+//       }
+//       ...
+//       CORO_END(c);
+//   }
+typedef struct coro_s {
+    uint32_t line;                      // Where to resume, or 0 to start from the top
+    bool (*func)(struct coro_s *c);     // Returns true when the coroutine has finished
+    void *arg;
+    int64_t deadlineMs;
+    bool timedOut;
+    volatile bool done;
+    job job;
+} coro;
+typedef bool (*coroFunc)(coro *c);
+
+#define CORO_BEGIN(c)       switch ((c)->line) { case 0:
+#define CORO_END(c)         } (c)->line = 0; return true
+#define CORO_EXIT(c)        do { (c)->line = 0; return true; } while (0)
+#define CORO_AWAIT(c, cond) do { (c)->line = __LINE__; case __LINE__: if (!(cond)) { return false; } } while (0)
+#define CORO_AWAIT_TIMEOUT(c, cond, ms)                                                         \
+                            do {                                                                \
+                                coroArm((c), (ms));                                             \
+                                (c)->line = __LINE__; case __LINE__:                            \
+                                if (!(cond)) {                                                  \
+                                    if (!coroExpired(c)) {                                      \
+                                        return false;                                           \
+                                    }                                                           \
+                                    (c)->timedOut = true;                                       \
+                                }                                                               \
+                                coroDisarm(c);                                                  \
+                            } while (0)
+#define CORO_SLEEP(c, ms)   CORO_AWAIT_TIMEOUT(c, false, ms)
+#define CORO_YIELD(c)       do { (c)->line = __LINE__; coroWake(c); return false; case __LINE__: ; } while (0)
+
+// coro.c
+void coroStart(coro *c, coroFunc func, void *arg, uint32_t priority);
+void coroWake(coro *c);
+void coroWakeFromISR(coro *c);
+bool coroIsDone(coro *c);
+bool coroTimedOut(coro *c);
+void coroArm(coro *c, uint32_t ms);
+bool coroExpired(coro *c);
+void coroDisarm(coro *c);
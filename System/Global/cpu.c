@@ -0,0 +1,150 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "global.h"
+
+// The FreeRTOS run time counter is timerUs(), which already includes time spent in STOP2, and so
+// that time is only counted here so that "top" can show how much of the idle task's was asleep.
+// The kernel keeps the counter in 32 bits, so it wraps every 71 minutes, which is fine for the
+// deltas that we take from it.
+STATIC uint32_t cpuStop2Us = 0;
+
+// Snapshots of the run time of each task, taken periodically by the main task so that "top" can
+// report on the most recent window rather than on everything since boot.  Snapshots are taken
+// and copied out with the scheduler suspended so that "top" never sees one half-written.
+#define CPU_MAX_TASKS       8
+#define CPU_SAMPLES         10
+#define CPU_SAMPLE_MS       1000
+typedef struct {
+    uint32_t us;
+    uint32_t stop2Us;
+    uint32_t tasks;
+    UBaseType_t idleTaskNumber;
+    UBaseType_t taskNumber[CPU_MAX_TASKS];
+    uint32_t taskUs[CPU_MAX_TASKS];
+    const char *taskName[CPU_MAX_TASKS];
+    uint32_t taskStack[CPU_MAX_TASKS];
+} cpuSnapshot;
+STATIC cpuSnapshot cpuSamples[CPU_SAMPLES];
+STATIC uint32_t cpuSampleCount = 0;
+STATIC uint32_t cpuSampleNext = 0;
+STATIC int64_t cpuSampledMs = 0;
+STATIC TaskStatus_t cpuStatus[CPU_MAX_TASKS];
+STATIC cpuSnapshot cpuTopThen;
+STATIC cpuSnapshot cpuTopNow;
+
+// Forwards
+void cpuSnapshotTake(cpuSnapshot *snap);
+
+// Start the run time counter, called by the kernel when the scheduler starts.  timerUs() has been
+// running since the clock was configured, so there's nothing to do.
+void cpuRunTimeInit(void)
+{
+}
+
+// Get the run time counter, which is called by the kernel on every context switch
+uint32_t cpuRunTimeCounter(void)
+{
+    return (uint32_t) timerUs();
+}
+
+// Account for time spent in STOP2, which timerUs() includes once it has been stepped into the
+// tick.  This is called from the idle task, so the time is charged to it.
+void cpuSleptMs(uint32_t ms)
+{
+    cpuStop2Us += ms * 1000;
+    ktraceRecord(KTRACE_SLEEP, ms);
+}
+
+// Record the run time of every task, from the main task only because the status array is shared
+void cpuSnapshotTake(cpuSnapshot *snap)
+{
+    uint32_t totalRunTime;
+    UBaseType_t tasks = uxTaskGetSystemState(cpuStatus, CPU_MAX_TASKS, &totalRunTime);
+    snap->us = cpuRunTimeCounter();
+    snap->stop2Us = cpuStop2Us;
+    snap->tasks = tasks;
+    snap->idleTaskNumber = 0;
+    for (UBaseType_t i=0; i<tasks; i++) {
+        snap->taskNumber[i] = cpuStatus[i].xTaskNumber;
+        snap->taskUs[i] = cpuStatus[i].ulRunTimeCounter;
+        snap->taskName[i] = cpuStatus[i].pcTaskName;
+        snap->taskStack[i] = cpuStatus[i].usStackHighWaterMark;
+        if (cpuStatus[i].xHandle == xTaskGetIdleTaskHandle()) {
+            snap->idleTaskNumber = cpuStatus[i].xTaskNumber;
+        }
+    }
+}
+
+// Take a snapshot if it has been long enough since the last one.  This is cheap enough to call
+// from the main task's polling loop, which is the only place that it may be called from.
+void cpuSample(void)
+{
+    if (cpuSampleCount != 0 && !timerMsElapsed(cpuSampledMs, CPU_SAMPLE_MS)) {
+        return;
+    }
+    cpuSampledMs = timerMs();
+    vTaskSuspendAll();
+    cpuSnapshotTake(&cpuSamples[cpuSampleNext]);
+    cpuSampleNext = (cpuSampleNext + 1) % CPU_SAMPLES;
+    if (cpuSampleCount < CPU_SAMPLES) {
+        cpuSampleCount++;
+    }
+    xTaskResumeAll();
+}
+
+// Display the CPU usage of each task between the oldest and newest retained snapshots, splitting
+// the idle task's time into time spent running and time spent in STOP2
+void cpuTop(void)
+{
+
+    // Copy out the oldest and newest snapshots so that sampling may carry on while we display
+    vTaskSuspendAll();
+    uint32_t count = cpuSampleCount;
+    if (count >= 2) {
+        cpuTopThen = cpuSamples[(cpuSampleNext + CPU_SAMPLES - count) % CPU_SAMPLES];
+        cpuTopNow = cpuSamples[(cpuSampleNext + CPU_SAMPLES - 1) % CPU_SAMPLES];
+    }
+    xTaskResumeAll();
+    if (count < 2) {
+        debugR("cpu: not enough samples yet\n");
+        return;
+    }
+    cpuSnapshot *then = &cpuTopThen;
+    cpuSnapshot *now = &cpuTopNow;
+    uint32_t windowUs = now->us - then->us;
+    uint32_t stop2Us = now->stop2Us - then->stop2Us;
+    if (windowUs == 0) {
+        windowUs = 1;
+    }
+
+    // Display each task, noting that tasks created since the oldest snapshot have run only since then
+    debugR("cpu over the last %lums:\n", (unsigned long) (windowUs / 1000));
+    debugR("%-16s %7s %10s %6s\n", "task", "cpu%", "us", "stack");
+    uint32_t busyUs = 0;
+    for (uint32_t i=0; i<now->tasks; i++) {
+        uint32_t taskUs = now->taskUs[i];
+        for (uint32_t j=0; j<then->tasks; j++) {
+            if (then->taskNumber[j] == now->taskNumber[i]) {
+                taskUs -= then->taskUs[j];
+                break;
+            }
+        }
+        debugR("%-16s %6.1f%% %10lu %6lu\n", now->taskName[i], (double) taskUs * 100.0 / windowUs,
+               (unsigned long) taskUs, (unsigned long) now->taskStack[i]);
+        if (now->taskNumber[i] == now->idleTaskNumber) {
+            uint32_t idleRunUs = (taskUs > stop2Us) ? taskUs - stop2Us : 0;
+            debugR("%-16s %6.1f%% %10lu\n", "  idle running", (double) idleRunUs * 100.0 / windowUs, (unsigned long) idleRunUs);
+            debugR("%-16s %6.1f%% %10lu\n", "  idle in stop2", (double) stop2Us * 100.0 / windowUs, (unsigned long) stop2Us);
+        } else {
+            busyUs += taskUs;
+        }
+    }
+    debugR("busy %.1f%%\n", (double) busyUs * 100.0 / windowUs);
+    if (now->tasks == 0) {
+        debugR("more than %d tasks\n", CPU_MAX_TASKS);
+    }
+
+}
@@ -9,6 +9,103 @@
 
 STATIC atomic_int debugPaused = 0;
 
+// In binary mode, debugf and debugR emit a compact record rather than formatted text, and
+// Tools/logdecode.py recovers the text using the format strings in the firmware image.  A record
+// is a zero byte (which never appears in text output), the length of what follows, and then
+// varints: the offset of the format within flash, the milliseconds since the previous record, and
+// the arguments.  Lines whose formats can't be encoded are output as text.
+#define DEBUG_BINARY_MARKER     0x00
+#define DEBUG_BINARY_MAX        96
+
+// Text output is formatted a line at a time, so that output from different tasks isn't interleaved
+// within lines that fit
+#define DEBUG_LINE_BYTES        96
+typedef struct {
+    uint32_t len;
+    char buf[DEBUG_LINE_BYTES];
+} debugLine;
+STATIC atomic_bool debugBinaryMode = false;
+STATIC atomic_uint debugBinaryLastMs = 0;
+
+// Modules enabled at each debug level, by default everything but trace
+uint32_t debugModuleMask[DEBUG_LEVELS] = {DEBUG_ALL, DEBUG_ALL, DEBUG_ALL, 0};
+
+// Names of modules and levels, as used by the "trace" diag command
+typedef struct {
+    const char *name;
+    uint32_t module;
+} debugModuleName;
+STATIC const debugModuleName debugModuleNames[] = {
+    {"app", DEBUG_APP},
+    {"serial", DEBUG_SERIAL},
+    {"mutex", DEBUG_MUTEX},
+    {"task", DEBUG_TASK},
+    {"timer", DEBUG_TIMER},
+    {"mem", DEBUG_MEM},
+    {"req", DEBUG_REQ},
+    {"all", DEBUG_ALL},
+    {NULL, 0},
+};
+STATIC const char *debugLevelNames[DEBUG_LEVELS] = {"error", "warn", "info", "trace"};
+
+// Look up a module by name, returning 0 if not found
+uint32_t debugModuleByName(const char *name)
+{
+    for (int i=0; debugModuleNames[i].name != NULL; i++) {
+        if (streql(debugModuleNames[i].name, name)) {
+            return debugModuleNames[i].module;
+        }
+    }
+    return 0;
+}
+
+// Look up a level by name, where "off" disables all levels
+err_t debugLevelByName(const char *name, int *level)
+{
+    if (streql(name, "off")) {
+        *level = DEBUG_LEVEL_OFF;
+        return errNone;
+    }
+    for (int i=0; i<DEBUG_LEVELS; i++) {
+        if (streql(debugLevelNames[i], name)) {
+            *level = i;
+            return errNone;
+        }
+    }
+    return errF("unknown debug level '%s'", name);
+}
+
+// Enable modules at and below the specified level, and disable them above it
+void debugSetModuleLevel(uint32_t modules, int level)
+{
+    for (int i=0; i<DEBUG_LEVELS; i++) {
+        if (i <= level) {
+            debugModuleMask[i] |= modules;
+        } else {
+            debugModuleMask[i] &= ~modules;
+        }
+    }
+}
+
+// Display the level at which each module is enabled
+void debugModuleLevels(void)
+{
+    for (int i=0; debugModuleNames[i].name != NULL; i++) {
+        uint32_t module = debugModuleNames[i].module;
+        if (module == DEBUG_ALL) {
+            continue;
+        }
+        const char *levelName = "off";
+        for (int level=0; level<DEBUG_LEVELS; level++) {
+            if (debugModuleMask[level] & module) {
+                levelName = debugLevelNames[level];
+            }
+        }
+        debugR("  %8s: %s\n", debugModuleNames[i].name, levelName);
+    }
+    debugR("  (compiled up to %s)\n", debugLevelNames[DEBUG_LEVEL]);
+}
+
 // Suppress debug output temporarily
 void debugPause(void)
 {
@@ -35,17 +132,197 @@ void debugResume(void)
     }
 }
 
+// Select binary or text debug output
+void debugBinary(bool on)
+{
+    atomic_store(&debugBinaryMode, on);
+}
+
+// See if debug output is binary
+bool debugIsBinary(void)
+{
+    return atomic_load(&debugBinaryMode);
+}
+
+// Append a varint, returning its length or 0 if there isn't room
+static uint32_t debugVarint(uint8_t *p, uint32_t left, uint64_t v)
+{
+    uint32_t len = 0;
+    do {
+        if (len >= left) {
+            return 0;
+        }
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        p[len++] = b | (v ? 0x80 : 0);
+    } while (v);
+    return len;
+}
+
+// Encode a binary log record, returning its length or 0 if it must be output as text
+static uint32_t debugEncode(uint8_t *rec, uint32_t reclen, const char *format, va_list args)
+{
+#if defined(FLASH_BASE) && defined(FLASH_END)
+    if ((uint32_t) format < FLASH_BASE || (uint32_t) format > FLASH_END) {
+        return 0;
+    }
+    uint32_t nowMs = (uint32_t) timerMs();
+    uint32_t deltaMs = nowMs - atomic_exchange(&debugBinaryLastMs, nowMs);
+    uint32_t len = 2, n;
+    if ((n = debugVarint(&rec[len], reclen-len, (uint32_t) format - FLASH_BASE)) == 0) {
+        return 0;
+    }
+    len += n;
+    if ((n = debugVarint(&rec[len], reclen-len, deltaMs)) == 0) {
+        return 0;
+    }
+    len += n;
+
+    // Encode arguments, zigzag-encoding those that are signed
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        if (*++p == '%') {
+            continue;
+        }
+        uint32_t stars, argType;
+        int precision;
+        uint32_t convLen = fmtConversion(p, &stars, &argType, &precision);
+        if (convLen == 0) {
+            return 0;
+        }
+        p += convLen-1;
+        bool isSigned = (*p == 'd' || *p == 'i');
+        int64_t sv = 0;
+        uint64_t uv = 0;
+        for (int i=0; i<stars; i++) {
+            sv = va_arg(args, int);
+            if ((n = debugVarint(&rec[len], reclen-len, (((uint64_t) sv << 1) ^ (uint64_t) (sv >> 63)))) == 0) {
+                return 0;
+            }
+            len += n;
+            if (precision == FMT_PRECISION_ARG && i == stars-1) {
+                precision = (sv < 0) ? FMT_PRECISION_NONE : (int) sv;
+            }
+        }
+        switch (argType) {
+        case FMT_ARG_STR: {
+            // With a precision the string need not be terminated, so read no further than it
+            char *str = va_arg(args, char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            uint32_t strLen = 0;
+            while (str[strLen] != '\0' && (precision < 0 || strLen < (uint32_t) precision)) {
+                strLen++;
+            }
+            if ((n = debugVarint(&rec[len], reclen-len, strLen)) == 0 || len+n+strLen > reclen) {
+                return 0;
+            }
+            len += n;
+            memcpy(&rec[len], str, strLen);
+            len += strLen;
+            continue;
+        }
+        case FMT_ARG_DOUBLE: {
+            double d = va_arg(args, double);
+            if (len+sizeof(d) > reclen) {
+                return 0;
+            }
+            memcpy(&rec[len], &d, sizeof(d));
+            len += sizeof(d);
+            continue;
+        }
+        case FMT_ARG_PTR:
+            uv = (uint32_t) va_arg(args, void *);
+            break;
+        case FMT_ARG_LONG:
+            sv = va_arg(args, long);
+            uv = (unsigned long) sv;
+            break;
+        case FMT_ARG_LLONG:
+            sv = va_arg(args, long long);
+            uv = (uint64_t) sv;
+            break;
+        case FMT_ARG_SIZE:
+            uv = va_arg(args, size_t);
+            sv = (int64_t) uv;
+            break;
+        default:
+            sv = va_arg(args, int);
+            uv = (unsigned int) sv;
+            break;
+        }
+        if (isSigned) {
+            uv = (((uint64_t) sv << 1) ^ (uint64_t) (sv >> 63));
+        }
+        if ((n = debugVarint(&rec[len], reclen-len, uv)) == 0) {
+            return 0;
+        }
+        len += n;
+    }
+
+    // The length byte limits the record to 127 bytes following it
+    if (len-2 > 0x7f) {
+        return 0;
+    }
+    rec[0] = DEBUG_BINARY_MARKER;
+    rec[1] = (uint8_t) (len-2);
+    return len;
+#else
+    return 0;
+#endif
+}
+
+// Sink for formatted text, which is output whenever the line buffer fills
+static void debugLineSink(void *sinkCtx, const char *buf, uint32_t len)
+{
+    debugLine *line = (debugLine *) sinkCtx;
+    while (len > 0) {
+        uint32_t chunk = GMIN(len, DEBUG_LINE_BYTES - line->len);
+        memcpy(&line->buf[line->len], buf, chunk);
+        line->len += chunk;
+        buf += chunk;
+        len -= chunk;
+        if (line->len == DEBUG_LINE_BYTES) {
+            MX_DBG(line->buf, line->len);
+            line->len = 0;
+        }
+    }
+}
+
+// Output formatted debug output, in binary if enabled
+static void debugOutputV(const char *strFormat, va_list vaArgs)
+{
+    if (atomic_load(&debugBinaryMode)) {
+        uint8_t rec[DEBUG_BINARY_MAX];
+        va_list binArgs;
+        va_copy(binArgs, vaArgs);
+        uint32_t reclen = debugEncode(rec, sizeof(rec), strFormat, binArgs);
+        va_end(binArgs);
+        if (reclen > 0) {
+            MX_DBG((char *) rec, reclen);
+            return;
+        }
+    }
+    debugLine line;
+    line.len = 0;
+    fmtV(debugLineSink, &line, strFormat, vaArgs);
+    if (line.len > 0) {
+        MX_DBG(line.buf, line.len);
+    }
+}
+
 // Output a debug string raw
 void debugR(const char *strFormat, ...)
 {
     if (atomic_load(&debugPaused) != 0) {
         return;
     }
-    char buf[MAXERRSTRING];
     va_list vaArgs;
     va_start(vaArgs, strFormat);
-    vsnprintf(buf, sizeof(buf), strFormat, vaArgs);
-    MX_DBG(buf, strlen(buf));
+    debugOutputV(strFormat, vaArgs);
     va_end(vaArgs);
 }
 
@@ -73,11 +350,9 @@ void debugf(const char *strFormat, ...)
     if (atomic_load(&debugPaused) != 0) {
         return;
     }
-    char buf[MAXERRSTRING];
     va_list vaArgs;
     va_start(vaArgs, strFormat);
-    vsnprintf(buf, sizeof(buf), strFormat, vaArgs);
-    MX_DBG(buf, strlen(buf));
+    debugOutputV(strFormat, vaArgs);
     va_end(vaArgs);
 }
 
@@ -93,6 +368,7 @@ void debugSoftPanic(const char *message)
     debugMessage("*****\n");
     debugMessage((char *)message);
     debugMessage("\n*****\n");
+    MX_DBG_Flush();
     MX_Breakpoint();
 }
 
@@ -0,0 +1,681 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Printf-style formatting: a compact engine that streams its output to a sink, and a parser for
+// code that must interpret formats without formatting them, such as when arguments are captured
+// now so that they may be formatted later or elsewhere.
+
+#include <stdarg.h>
+#include "global.h"
+
+// Parse the printf conversion that follows a '%', returning the number of '*' arguments that precede
+// its value, the value's type, its precision, and the length of the conversion, whose last
+// character is the conversion specifier.  The precision is FMT_PRECISION_ARG if it is the last of
+// the '*' arguments.  Returns 0 for conversions that aren't supported, such as %n.
+uint32_t fmtConversion(const char *p, uint32_t *stars, uint32_t *argType, int *precision)
+{
+    const char *start = p;
+    *stars = 0;
+    *precision = FMT_PRECISION_NONE;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        p++;
+    }
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            *precision = FMT_PRECISION_ARG;
+            p++;
+        } else {
+            *precision = 0;
+        }
+        while (*p >= '0' && *p <= '9') {
+            *precision = (*precision * 10) + (*p - '0');
+            p++;
+        }
+    }
+    uint32_t longs = 0;
+    bool sized = false;
+    for (;; p++) {
+        if (*p == 'l') {
+            longs++;
+        } else if (*p == 'z' || *p == 't') {
+            sized = true;
+        } else if (*p == 'j') {
+            longs = 2;
+        } else if (*p != 'h') {
+            break;
+        }
+    }
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+        *argType = sized ? FMT_ARG_SIZE : (longs == 0 ? FMT_ARG_INT : (longs == 1 ? FMT_ARG_LONG : FMT_ARG_LLONG));
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        *argType = FMT_ARG_DOUBLE;
+        break;
+    case 'p':
+        *argType = FMT_ARG_PTR;
+        break;
+    case 's':
+        *argType = FMT_ARG_STR;
+        break;
+    default:
+        return 0;
+    }
+    return (p - start) + 1;
+}
+
+// A compact printf engine that streams its output to a sink rather than requiring a buffer large
+// enough for the entire result, and that avoids the weight of the C library's printf.  Integers
+// that fit in 32 bits are converted without 64-bit division, and %f is done in fixed point.
+// Floating point conversions may be removed with FMT_FLOAT, in which case they output "?".
+// Output matches the C library's except where the fixed point arithmetic runs out of range:
+// floating point output is limited to 9 digits after the point, so "%.12f" is formatted as
+// "%.9f", and %f of a magnitude above 1.8e19 is formatted as %e because its whole part won't
+// fit in 64 bits.
+// Conversions outside the C library's set, such as %n, are output verbatim.
+#ifndef FMT_FLOAT
+#define FMT_FLOAT               1
+#endif
+#define FMT_STAGE_BYTES         32
+#define FMT_FLAG_LEFT           0x01
+#define FMT_FLAG_ZERO           0x02
+#define FMT_FLAG_PLUS           0x04
+#define FMT_FLAG_SPACE          0x08
+#define FMT_FLAG_ALT            0x10
+
+// Output is staged so that the sink isn't called for every character
+typedef struct {
+    fmtSink_t sink;
+    void *sinkCtx;
+    uint32_t count;
+    uint32_t staged;
+    char stage[FMT_STAGE_BYTES];
+} fmtState;
+
+// Send staged output to the sink
+static void fmtFlush(fmtState *st)
+{
+    if (st->staged > 0) {
+        st->sink(st->sinkCtx, st->stage, st->staged);
+        st->staged = 0;
+    }
+}
+
+// Output characters
+static void fmtPut(fmtState *st, const char *s, uint32_t len)
+{
+    st->count += len;
+    while (len > 0) {
+        if (st->staged == FMT_STAGE_BYTES) {
+            fmtFlush(st);
+        }
+        uint32_t chunk = GMIN(len, FMT_STAGE_BYTES - st->staged);
+        memcpy(&st->stage[st->staged], s, chunk);
+        st->staged += chunk;
+        s += chunk;
+        len -= chunk;
+    }
+}
+
+// Output a character repeatedly
+static void fmtPad(fmtState *st, char ch, int32_t n)
+{
+    if (n <= 0) {
+        return;
+    }
+    st->count += n;
+    while (n > 0) {
+        if (st->staged == FMT_STAGE_BYTES) {
+            fmtFlush(st);
+        }
+        uint32_t chunk = GMIN((uint32_t) n, FMT_STAGE_BYTES - st->staged);
+        memset(&st->stage[st->staged], ch, chunk);
+        st->staged += chunk;
+        n -= chunk;
+    }
+}
+
+// Output a field, which is an optional prefix such as a sign, zeroes to reach a minimum number of
+// digits, and the body, padded to the width
+static void fmtField(fmtState *st, uint32_t flags, int32_t width, const char *prefix, int32_t zeroes, const char *body, int32_t bodyLen)
+{
+    int32_t prefixLen = strlen(prefix);
+    int32_t pad = width - (prefixLen + zeroes + bodyLen);
+    if ((flags & FMT_FLAG_ZERO) && !(flags & FMT_FLAG_LEFT) && pad > 0) {
+        zeroes += pad;
+        pad = 0;
+    }
+    if (!(flags & FMT_FLAG_LEFT)) {
+        fmtPad(st, ' ', pad);
+    }
+    fmtPut(st, prefix, prefixLen);
+    fmtPad(st, '0', zeroes);
+    fmtPut(st, body, bodyLen);
+    if (flags & FMT_FLAG_LEFT) {
+        fmtPad(st, ' ', pad);
+    }
+}
+
+// Convert an unsigned value to digits at the end of a buffer, returning the first digit
+static char *fmtDigits(uint64_t v, uint32_t base, bool upper, char *end)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+    uint32_t v32 = (uint32_t) v;
+    while (v > 0xffffffffULL) {
+        *--p = digits[v % base];
+        v /= base;
+        v32 = (uint32_t) v;
+    }
+    do {
+        *--p = digits[v32 % base];
+        v32 /= base;
+    } while (v32 != 0);
+    return p;
+}
+
+#if FMT_FLOAT
+// Ten to a power, exactly for the non-negative powers that a double can hold exactly
+static double fmtPow10(int32_t n)
+{
+    double p = 1.0;
+    for (int32_t i=0; i<(n < 0 ? -n : n); i++) {
+        p *= 10.0;
+    }
+    return n < 0 ? 1.0 / p : p;
+}
+
+// The decimal exponent of a non-negative value, which is 0 for zero
+static int32_t fmtExponent(double v)
+{
+    if (v == 0) {
+        return 0;
+    }
+    int32_t exponent = 0;
+    double scaled = v;
+    while (scaled >= 10.0) {
+        scaled /= 10.0;
+        exponent++;
+    }
+    while (scaled < 1.0) {
+        scaled *= 10.0;
+        exponent--;
+    }
+    // Repeated division may have landed one off at an exact power of ten
+    if (v >= fmtPow10(exponent+1)) {
+        exponent++;
+    } else if (v < fmtPow10(exponent)) {
+        exponent--;
+    }
+    return exponent;
+}
+
+// Round to the nearest integer, with exact halves to even
+static uint64_t fmtRound(double v)
+{
+    uint64_t whole = (uint64_t) v;
+    double remainder = v - (double) whole;
+    if (remainder > 0.5 || (remainder == 0.5 && (whole & 1))) {
+        whole++;
+    }
+    return whole;
+}
+
+// Format a double in fixed point (%f), or in exponential notation (%e) if the exponent is supplied
+static void fmtDouble(fmtState *st, uint32_t flags, int32_t width, int32_t precision, double v, char conv, bool upper)
+{
+    char prefix[2] = {0};
+    if (v < 0) {
+        prefix[0] = '-';
+        v = -v;
+    } else if (flags & FMT_FLAG_PLUS) {
+        prefix[0] = '+';
+    } else if (flags & FMT_FLAG_SPACE) {
+        prefix[0] = ' ';
+    }
+    if (v != v) {
+        fmtField(st, flags & ~FMT_FLAG_ZERO, width, prefix, 0, upper ? "NAN" : "nan", 3);
+        return;
+    }
+    if (v - v != 0) {
+        fmtField(st, flags & ~FMT_FLAG_ZERO, width, prefix, 0, upper ? "INF" : "inf", 3);
+        return;
+    }
+    if (v > 1.8e19 && conv == 'f') {
+        conv = 'e';     // The whole part must fit in 64 bits
+    }
+    if (precision < 0) {
+        precision = 6;
+    }
+
+    // %g uses %e for very large or small values, and never has trailing zeroes
+    bool trim = false;
+    int32_t exponent = 0;
+    if (conv == 'g') {
+        trim = !(flags & FMT_FLAG_ALT);
+        if (precision == 0) {
+            precision = 1;
+        }
+        exponent = fmtExponent(v);
+        // The exponent is that of the value once rounded to the precision, such as 999999.5 to
+        // 1e+06, and the bound is computed from exact powers of ten rather than from the scaled value
+        if (v >= fmtPow10(exponent+1) - fmtPow10(exponent+1-precision) / 2) {
+            exponent++;
+        }
+        if (exponent < -4 || exponent >= precision) {
+            conv = 'e';
+            precision--;
+        } else {
+            conv = 'f';
+            precision = precision - 1 - exponent;
+        }
+    }
+    if (precision > 9) {
+        precision = 9;  // The fraction must fit in 32 bits
+    }
+
+    // Split into whole and fractional parts in fixed point, rounding exact halves to even
+    uint32_t scale = 1;
+    for (int i=0; i<precision; i++) {
+        scale *= 10;
+    }
+    uint64_t whole;
+    uint32_t frac;
+    if (conv == 'e') {
+
+        // Scale to precision+1 significant digits with a single multiply or divide by a power of
+        // ten, so that values such as 999999.5 aren't pulled below a rounding boundary by the
+        // error that repeated division by ten would accumulate
+        exponent = fmtExponent(v);
+        int32_t shift = precision - exponent;
+        double scaled = v;
+        if (shift < 0) {
+            scaled /= fmtPow10(-shift);
+        } else {
+            scaled *= fmtPow10(shift/2);
+            scaled *= fmtPow10(shift - shift/2);
+        }
+        uint64_t digits = fmtRound(scaled);
+        if (digits >= (uint64_t) scale * 10) {
+            digits /= 10;
+            exponent++;
+        }
+        whole = digits / scale;
+        frac = (uint32_t) (digits % scale);
+
+    } else {
+
+        whole = (uint64_t) v;
+        double scaled = (v - (double) whole) * scale;
+        frac = (uint32_t) scaled;
+        double remainder = scaled - frac;
+        if (remainder > 0.5 || (remainder == 0.5 && ((precision > 0 ? frac : (uint32_t) whole) & 1))) {
+            frac++;
+        }
+        if (frac >= scale) {
+            frac -= scale;
+            whole++;
+        }
+
+    }
+
+    // Assemble the body
+    char body[48];
+    char *end = &body[24];
+    char *p = fmtDigits(whole, 10, false, end);
+    int32_t len = end - p;
+    memmove(body, p, len);
+    if (precision > 0 || (flags & FMT_FLAG_ALT)) {
+        body[len++] = '.';
+        if (precision > 0) {
+            char fracDigits[12];
+            char *fracEnd = &fracDigits[sizeof(fracDigits)];
+            char *f = fmtDigits(frac, 10, false, fracEnd);
+            for (int i=fracEnd-f; i<precision; i++) {
+                body[len++] = '0';
+            }
+            memcpy(&body[len], f, fracEnd-f);
+            len += fracEnd-f;
+        }
+        if (trim) {
+            while (body[len-1] == '0') {
+                len--;
+            }
+            if (body[len-1] == '.') {
+                len--;
+            }
+        }
+    }
+    if (conv == 'e') {
+        body[len++] = upper ? 'E' : 'e';
+        body[len++] = exponent < 0 ? '-' : '+';
+        uint32_t absExponent = exponent < 0 ? -exponent : exponent;
+        if (absExponent < 10) {
+            body[len++] = '0';
+        }
+        char expDigits[6];
+        char *expEnd = &expDigits[sizeof(expDigits)];
+        char *e = fmtDigits(absExponent, 10, false, expEnd);
+        memcpy(&body[len], e, expEnd-e);
+        len += expEnd-e;
+    }
+    fmtField(st, flags, width, prefix, 0, body, len);
+}
+#endif
+
+// Format to a sink, returning the number of characters output
+uint32_t fmtV(fmtSink_t sink, void *sinkCtx, const char *format, va_list args)
+{
+    fmtState st;
+    st.sink = sink;
+    st.sinkCtx = sinkCtx;
+    st.count = 0;
+    st.staged = 0;
+
+    const char *p = format;
+    while (*p != '\0') {
+
+        // Output literal text in a single chunk
+        const char *literal = p;
+        while (*p != '\0' && *p != '%') {
+            p++;
+        }
+        if (p > literal) {
+            fmtPut(&st, literal, p - literal);
+        }
+        if (*p == '\0') {
+            break;
+        }
+        p++;
+
+        // Flags, width, and precision
+        uint32_t flags = 0;
+        for (;; p++) {
+            if (*p == '-') {
+                flags |= FMT_FLAG_LEFT;
+            } else if (*p == '0') {
+                flags |= FMT_FLAG_ZERO;
+            } else if (*p == '+') {
+                flags |= FMT_FLAG_PLUS;
+            } else if (*p == ' ') {
+                flags |= FMT_FLAG_SPACE;
+            } else if (*p == '#') {
+                flags |= FMT_FLAG_ALT;
+            } else {
+                break;
+            }
+        }
+        int32_t width = 0;
+        if (*p == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FMT_FLAG_LEFT;
+                width = -width;
+            }
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            width = (width * 10) + (*p++ - '0');
+        }
+        int32_t precision = -1;
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            if (*p == '*') {
+                precision = va_arg(args, int);
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                precision = (precision * 10) + (*p++ - '0');
+            }
+        }
+
+        // Length modifiers
+        uint32_t longs = 0;
+        uint32_t shorts = 0;
+        bool sized = false;
+        for (;; p++) {
+            if (*p == 'l') {
+                longs++;
+            } else if (*p == 'h') {
+                shorts++;
+            } else if (*p == 'z' || *p == 't') {
+                sized = true;
+            } else if (*p == 'j') {
+                longs = 2;
+            } else {
+                break;
+            }
+        }
+
+        // Conversion
+        char conv = *p;
+        if (conv == '\0') {
+            break;
+        }
+        p++;
+        switch (conv) {
+
+        case '%':
+            fmtPut(&st, "%", 1);
+            break;
+
+        case 'c': {
+            char ch = (char) va_arg(args, int);
+            fmtField(&st, flags & ~FMT_FLAG_ZERO, width, "", 0, &ch, 1);
+            break;
+        }
+
+        case 's': {
+            const char *str = va_arg(args, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            int32_t len = 0;
+            while (str[len] != '\0' && (precision < 0 || len < precision)) {
+                len++;
+            }
+            fmtField(&st, flags & ~FMT_FLAG_ZERO, width, "", 0, str, len);
+            break;
+        }
+
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'p': {
+            uint64_t v;
+            bool negative = false;
+            if (conv == 'p') {
+                v = (uintptr_t) va_arg(args, void *);
+                flags |= FMT_FLAG_ALT;
+            } else if (conv == 'd' || conv == 'i') {
+                int64_t sv;
+                if (sized) {
+                    sv = (int64_t) va_arg(args, size_t);
+                } else if (longs == 0) {
+                    sv = va_arg(args, int);
+                    if (shorts == 1) {
+                        sv = (short) sv;
+                    } else if (shorts > 1) {
+                        sv = (signed char) sv;
+                    }
+                } else if (longs == 1) {
+                    sv = va_arg(args, long);
+                } else {
+                    sv = va_arg(args, long long);
+                }
+                negative = (sv < 0);
+                v = negative ? 0 - (uint64_t) sv : (uint64_t) sv;
+            } else {
+                if (sized) {
+                    v = va_arg(args, size_t);
+                } else if (longs == 0) {
+                    v = va_arg(args, unsigned int);
+                    if (shorts == 1) {
+                        v = (unsigned short) v;
+                    } else if (shorts > 1) {
+                        v = (unsigned char) v;
+                    }
+                } else if (longs == 1) {
+                    v = va_arg(args, unsigned long);
+                } else {
+                    v = va_arg(args, unsigned long long);
+                }
+            }
+            uint32_t base = (conv == 'o') ? 8 : ((conv == 'd' || conv == 'i' || conv == 'u') ? 10 : 16);
+            char digits[24];
+            char *end = &digits[sizeof(digits)];
+            char *start = fmtDigits(v, base, conv == 'X', end);
+            int32_t len = end - start;
+            if (precision == 0 && v == 0) {
+                len = 0;
+            }
+            const char *prefix = "";
+            if (negative) {
+                prefix = "-";
+            } else if ((flags & FMT_FLAG_PLUS) && base == 10) {
+                prefix = "+";
+            } else if ((flags & FMT_FLAG_SPACE) && base == 10) {
+                prefix = " ";
+            } else if ((flags & FMT_FLAG_ALT) && v != 0 && base == 16) {
+                prefix = (conv == 'X') ? "0X" : "0x";
+            }
+            int32_t zeroes = 0;
+            if (precision >= 0) {
+                zeroes = GMAX(0, precision - len);
+                flags &= ~FMT_FLAG_ZERO;
+            }
+            // Alternate octal only adds a zero if the digits don't already begin with one
+            if ((flags & FMT_FLAG_ALT) && base == 8 && zeroes == 0 && (len == 0 || *start != '0')) {
+                zeroes = 1;
+            }
+            fmtField(&st, flags, width, prefix, zeroes, start, len);
+            break;
+        }
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G': {
+            double v = va_arg(args, double);
+#if FMT_FLOAT
+            bool upper = (conv < 'a');
+            fmtDouble(&st, flags, width, precision, v, upper ? conv + ('a'-'A') : conv, upper);
+#else
+            UNUSED_VARIABLE(v);
+            fmtField(&st, flags & ~FMT_FLAG_ZERO, width, "", 0, "?", 1);
+#endif
+            break;
+        }
+
+        default:
+            // Unsupported conversions are output verbatim
+            fmtPut(&st, "%", 1);
+            fmtPut(&st, &conv, 1);
+            break;
+
+        }
+    }
+
+    fmtFlush(&st);
+    return st.count;
+}
+
+// Format to a sink
+uint32_t fmtPrint(fmtSink_t sink, void *sinkCtx, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    uint32_t count = fmtV(sink, sinkCtx, format, args);
+    va_end(args);
+    return count;
+}
+
+// Sink for a buffer, truncating at its end but always terminating it
+typedef struct {
+    char *buf;
+    uint32_t buflen;
+    uint32_t used;
+} fmtBuffer;
+static void fmtBufferSink(void *sinkCtx, const char *s, uint32_t len)
+{
+    fmtBuffer *b = (fmtBuffer *) sinkCtx;
+    uint32_t room = b->buflen - 1 - b->used;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(&b->buf[b->used], s, len);
+    b->used += len;
+}
+
+// Format into a buffer, like vsnprintf, returning the length that was written
+uint32_t fmtStringV(char *buf, uint32_t buflen, const char *format, va_list args)
+{
+    if (buflen == 0) {
+        return 0;
+    }
+    fmtBuffer b = {buf, buflen, 0};
+    fmtV(fmtBufferSink, &b, format, args);
+    buf[b.used] = '\0';
+    return b.used;
+}
+
+// Format into a buffer, like snprintf, returning the length that was written
+uint32_t fmtString(char *buf, uint32_t buflen, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    uint32_t len = fmtStringV(buf, buflen, format, args);
+    va_end(args);
+    return len;
+}
+
+// Sink for a byte array, remembering the first error
+typedef struct {
+    array *ctx;
+    err_t err;
+} fmtArraySink;
+static void fmtArrayAppend(void *sinkCtx, const char *s, uint32_t len)
+{
+    fmtArraySink *a = (fmtArraySink *) sinkCtx;
+    if (!a->err) {
+        a->err = arrayAppendBytes(a->ctx, (void *) s, len);
+    }
+}
+
+// Format, appending to a byte array without a terminator
+err_t fmtArray(array *ctx, const char *format, ...)
+{
+    fmtArraySink a = {ctx, errNone};
+    va_list args;
+    va_start(args, format);
+    fmtV(fmtArrayAppend, &a, format, args);
+    va_end(args);
+    return a.err;
+}
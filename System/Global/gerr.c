@@ -11,94 +11,371 @@
 #include "board.h"
 #include "mutex.h"
 
-// The core error entry data structure
+// When lazy formatting is enabled, errF() records the format and a packed copy of its arguments,
+// and the text is formatted only if errString() is called.  Errors that are tested and discarded,
+// as is common in retry loops, then never pay for vsnprintf.
+#ifndef ERR_LAZY_FORMAT
+#define ERR_LAZY_FORMAT         1
+#endif
+
+// The core error entry data structure.  If format is non-NULL, the text at the offset is the
+// packed arguments for that format rather than the formatted text.
 typedef struct {
+    const char *format;
     uint16_t errorTextOffset;
+    uint16_t errorTextLen;
+    uint16_t errorTextLap;
 } errorEntry_t;
 
 // These globals constrain the number of concurrent errors that may be being processed at any given
 // moment in time before losing context.  There is no downside to increasing the number other than memory.
 #define MAXCONCURRENTERRORS     15
 #define MAXCONCURRENTERRORTEXT  (256*3)
+#define MAXERRARGS              128
 STATIC errorEntry_t errors[MAXCONCURRENTERRORS];
 STATIC uint16_t errorsNext = 0;
 STATIC char errorText[MAXCONCURRENTERRORTEXT];
 STATIC uint16_t errorTextNext = 0;
+STATIC uint16_t errorTextLap = 0;
 STATIC mutex errorMutex = {MTX_ERR, {0}};
 
 // The fact that we offset by 1 simply guarantees that we never issue noError as a result
 #define errorEntryToError(x) ((err_t)(x+1))
 #define errorEntryFromError(x) (((uint16_t)x)-1)
 
-// Print an error, cascading it by adding the previous error as a suffix.  If there's nothing to cascade,
-// supply 0 as the first argument.  If format == NULL, we are guaranteed to return errNone;
-err_t errF(const char *format, ...)
+// Static errors are the address of their text, which is a string literal in flash
+#if defined(FLASH_BASE) && defined(FLASH_END)
+#define errIsStatic(x) ((uint32_t)(x) >= FLASH_BASE && (uint32_t)(x) <= FLASH_END)
+#elif defined(__ICCARM__) || defined(__arm__)
+#error "errStatic() needs FLASH_BASE and FLASH_END to tell static errors apart"
+#else
+#define errIsStatic(x) false
+#endif
+
+// Size of a packed argument of a given type
+static uint32_t errArgSize(uint32_t argType)
 {
-    char buffer[MAXERRSTRING];
-    char *buf = buffer;
-    int buflen = sizeof(buffer);
-    buf[0] = '\0';
+    switch (argType) {
+    case FMT_ARG_LONG:
+        return sizeof(long);
+    case FMT_ARG_LLONG:
+        return sizeof(long long);
+    case FMT_ARG_SIZE:
+        return sizeof(size_t);
+    case FMT_ARG_DOUBLE:
+        return sizeof(double);
+    case FMT_ARG_PTR:
+        return sizeof(void *);
+    }
+    return sizeof(int);
+}
 
-    // Exit if errF(NULL) is encountered - relied upon in file.c uses of FlashLock()
-    if (format == NULL) {
-        return errNone;
+// Pack the arguments of a format, returning the packed length or 0 if they can't be packed
+static uint32_t errPackArgs(const char *format, va_list args, uint8_t *packed, uint32_t packedLen)
+{
+    uint32_t len = 0;
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        if (*++p == '%') {
+            continue;
+        }
+        uint32_t stars, argType;
+        int precision;
+        uint32_t convLen = fmtConversion(p, &stars, &argType, &precision);
+        if (convLen == 0) {
+            return 0;
+        }
+        p += convLen-1;
+        for (int i=0; i<stars; i++) {
+            int star = va_arg(args, int);
+            if (len+sizeof(star) > packedLen) {
+                return 0;
+            }
+            memcpy(&packed[len], &star, sizeof(star));
+            len += sizeof(star);
+            if (precision == FMT_PRECISION_ARG && i == stars-1) {
+                precision = (star < 0) ? FMT_PRECISION_NONE : star;
+            }
+        }
+        union {
+            int i;
+            long l;
+            long long ll;
+            size_t z;
+            double d;
+            void *p;
+        } v;
+        switch (argType) {
+        case FMT_ARG_INT:
+            v.i = va_arg(args, int);
+            break;
+        case FMT_ARG_LONG:
+            v.l = va_arg(args, long);
+            break;
+        case FMT_ARG_LLONG:
+            v.ll = va_arg(args, long long);
+            break;
+        case FMT_ARG_SIZE:
+            v.z = va_arg(args, size_t);
+            break;
+        case FMT_ARG_DOUBLE:
+            v.d = va_arg(args, double);
+            break;
+        case FMT_ARG_PTR:
+            v.p = va_arg(args, void *);
+            break;
+        case FMT_ARG_STR: {
+            // Strings are copied because they are frequently in transient buffers, reading no
+            // further than the precision because with one they need not be terminated
+            char *str = va_arg(args, char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            uint32_t strLen = 0;
+            while (str[strLen] != '\0' && (precision < 0 || strLen < (uint32_t) precision)) {
+                strLen++;
+            }
+            if (len+strLen+1 > packedLen) {
+                return 0;
+            }
+            memcpy(&packed[len], str, strLen);
+            packed[len+strLen] = '\0';
+            len += strLen+1;
+            continue;
+        }
+        }
+        uint32_t argSize = errArgSize(argType);
+        if (len+argSize > packedLen) {
+            return 0;
+        }
+        memcpy(&packed[len], &v, argSize);
+        len += argSize;
     }
+    return len;
+}
 
-    // Process the printf portion of the work to be done
-    va_list args;
-    va_start (args, format);
-    vsnprintf (buf, buflen, format, args);
-    va_end (args);
+// Format text from a format and its packed arguments
+static void errFormatArgs(const char *format, const uint8_t *packed, char *buf, uint32_t buflen)
+{
+    uint32_t out = 0;
+    buf[0] = '\0';
+    for (const char *p = format; *p != '\0' && out < buflen-1; p++) {
+        if (*p != '%') {
+            buf[out++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf[out++] = *++p;
+            continue;
+        }
 
-    // Protect statics
-    mutexLock(&errorMutex);
+        // Rebuild the conversion with any '*' replaced by its packed value
+        uint32_t stars, argType;
+        int precision;
+        uint32_t convLen = fmtConversion(p+1, &stars, &argType, &precision);
+        char spec[32];
+        uint32_t specLen = 0;
+        for (uint32_t i=0; i<=convLen && specLen < sizeof(spec)-12; i++) {
+            if (p[i] == '*') {
+                int star;
+                memcpy(&star, packed, sizeof(star));
+                packed += sizeof(star);
+                specLen += fmtString(&spec[specLen], sizeof(spec)-specLen, "%d", star);
+            } else {
+                spec[specLen++] = p[i];
+            }
+        }
+        spec[specLen] = '\0';
+        p += convLen;
+
+        // Format the value
+        union {
+            int i;
+            long l;
+            long long ll;
+            size_t z;
+            double d;
+            void *p;
+        } v;
+        int n;
+        if (argType == FMT_ARG_STR) {
+            n = fmtString(&buf[out], buflen-out, spec, (const char *) packed);
+            packed += strlen((const char *) packed)+1;
+        } else {
+            memcpy(&v, packed, errArgSize(argType));
+            packed += errArgSize(argType);
+            switch (argType) {
+            case FMT_ARG_LONG:
+                n = fmtString(&buf[out], buflen-out, spec, v.l);
+                break;
+            case FMT_ARG_LLONG:
+                n = fmtString(&buf[out], buflen-out, spec, v.ll);
+                break;
+            case FMT_ARG_SIZE:
+                n = fmtString(&buf[out], buflen-out, spec, v.z);
+                break;
+            case FMT_ARG_DOUBLE:
+                n = fmtString(&buf[out], buflen-out, spec, v.d);
+                break;
+            case FMT_ARG_PTR:
+                n = fmtString(&buf[out], buflen-out, spec, v.p);
+                break;
+            default:
+                n = fmtString(&buf[out], buflen-out, spec, v.i);
+                break;
+            }
+        }
+        if (n > 0) {
+            out = GMIN(out + n, buflen-1);
+        }
+    }
+    buf[out] = '\0';
+}
 
-    // Insert the cleaned text into the error buffer, because the error may have been generated
-    // using user-generated data which has binary garbage within it
-    buflen = strlen(buffer) + 1;
-    if (buflen > (MAXCONCURRENTERRORTEXT - errorTextNext)) {
+// Reserve space in the error text buffer, wrapping if necessary.  Must be called with the mutex held.
+static uint16_t errTextReserve(uint32_t len)
+{
+    if (len > (MAXCONCURRENTERRORTEXT - errorTextNext)) {
         errorTextNext = 0;
+        errorTextLap++;
+    }
+    return errorTextNext;
+}
+
+// See if the text of an error entry has been overwritten since it was recorded.  Must be called
+// with the mutex held.
+static bool errTextOverwritten(errorEntry_t *entry)
+{
+    if (entry->errorTextLap == errorTextLap) {
+        return false;
+    }
+    if ((uint16_t)(entry->errorTextLap+1) == errorTextLap && entry->errorTextOffset >= errorTextNext) {
+        return false;
     }
+    return true;
+}
+
+// Add an entry to the error table, returning the error.  Must be called with the mutex held.
+static err_t errEntryAdd(const char *format, uint16_t offset, uint32_t len)
+{
+    errorTextNext = offset + len;
+    if (errorsNext >= MAXCONCURRENTERRORS) {
+        errorsNext = 0;
+    }
+    errorEntry_t *entry = &errors[errorsNext];
+    entry->format = format;
+    entry->errorTextOffset = offset;
+    entry->errorTextLen = len;
+    entry->errorTextLap = errorTextLap;
+    return errorEntryToError(errorsNext++);
+}
+
+// Insert cleaned text into the error buffer, because the error may have been generated using
+// user-generated data which has binary garbage within it.  Must be called with the mutex held.
+static uint16_t errTextInsert(const char *buffer, uint32_t *retLen)
+{
+    uint32_t buflen = strlen(buffer) + 1;
+    uint16_t offset = errTextReserve(buflen);
     for (int i=0;; i++) {
-        if (buffer[i] == 0 || i == (MAXCONCURRENTERRORTEXT-errorTextNext)-1) {
-            errorText[errorTextNext+i] = '\0';
+        if (buffer[i] == 0 || i == (MAXCONCURRENTERRORTEXT-offset)-1) {
+            errorText[offset+i] = '\0';
             break;
         }
         if (buffer[i] >= ' ' && buffer[i] < 0x7f) {
-            errorText[errorTextNext+i] = buffer[i];
+            errorText[offset+i] = buffer[i];
         } else {
-            errorText[errorTextNext+i] = '?';
+            errorText[offset+i] = '?';
         }
     }
-    errorEntry_t newEntry;
-    newEntry.errorTextOffset = errorTextNext;
+    *retLen = buflen;
+    return offset;
+}
+
+// Record an error by formatting its text immediately
+static err_t errFormatted(const char *format, va_list args)
+{
+    char buffer[MAXERRSTRING];
+    fmtStringV(buffer, sizeof(buffer), format, args);
+
+    // Protect statics
+    mutexLock(&errorMutex);
 
     // If this entry is identical to the previous entry, optimize it
     if (errorsNext > 0) {
-        uint16_t errorsPrev = errorsNext-1;
-        char *thisErrorText = &errorText[newEntry.errorTextOffset];
-        uint32_t thisErrorTextLen = strlen(thisErrorText);
-        char *prevErrorText = &errorText[errors[errorsPrev].errorTextOffset];
-        uint32_t prevErrorTextLen = strlen(prevErrorText);
-        if (thisErrorTextLen == prevErrorTextLen && memeql(thisErrorText, prevErrorText, thisErrorTextLen)) {
-            mutexUnlock(&errorMutex);
-            return errorEntryToError(errorsPrev);
+        errorEntry_t *prev = &errors[errorsNext-1];
+        if (prev->format == NULL && !errTextOverwritten(prev)) {
+            uint32_t len = strlen(buffer)+1;
+            if (len == prev->errorTextLen && memeql(buffer, &errorText[prev->errorTextOffset], len)) {
+                mutexUnlock(&errorMutex);
+                return errorEntryToError(errorsNext-1);
+            }
         }
     }
 
-    // Allocate the next error entry and fill it in
-    errorTextNext += buflen;
-    if (errorsNext >= MAXCONCURRENTERRORS) {
-        errorsNext = 0;
-    }
-    err_t errorToReturn = errorEntryToError(errorsNext);
-    errors[errorsNext++] = newEntry;
+    uint32_t len;
+    uint16_t offset = errTextInsert(buffer, &len);
+    err_t errorToReturn = errEntryAdd(NULL, offset, len);
 
     // Release
     mutexUnlock(&errorMutex);
 
-    // Return the new error entry
     return errorToReturn;
+}
+
+// Print an error, cascading it by adding the previous error as a suffix.  If there's nothing to cascade,
+// supply 0 as the first argument.  If format == NULL, we are guaranteed to return errNone;
+err_t errF(const char *format, ...)
+{
+    err_t err;
+
+    // Exit if errF(NULL) is encountered - relied upon in file.c uses of FlashLock()
+    if (format == NULL) {
+        return errNone;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+#if ERR_LAZY_FORMAT
+    // Pack the arguments, falling back to formatting now if the format isn't supported or if
+    // the arguments are too large
+    uint8_t packed[MAXERRARGS];
+    va_list packArgs;
+    va_copy(packArgs, args);
+    uint32_t packedLen = errPackArgs(format, packArgs, packed, sizeof(packed));
+    va_end(packArgs);
+    if (packedLen > 0 || strchr(format, '%') == NULL) {
+        va_end(args);
+
+        // Protect statics
+        mutexLock(&errorMutex);
+
+        // If this entry is identical to the previous entry, optimize it
+        if (errorsNext > 0) {
+            errorEntry_t *prev = &errors[errorsNext-1];
+            if (prev->format == format && prev->errorTextLen == packedLen && !errTextOverwritten(prev)
+                    && memeql(packed, &errorText[prev->errorTextOffset], packedLen)) {
+                mutexUnlock(&errorMutex);
+                return errorEntryToError(errorsNext-1);
+            }
+        }
+
+        uint16_t offset = errTextReserve(packedLen);
+        memcpy(&errorText[offset], packed, packedLen);
+        err = errEntryAdd(format, offset, packedLen);
+
+        // Release
+        mutexUnlock(&errorMutex);
+
+        return err;
+    }
+#endif
+
+    err = errFormatted(format, args);
+    va_end(args);
+    return err;
 
 }
 
@@ -111,6 +388,11 @@ char *errString(err_t err)
         return "";
     }
 
+    // Static errors are their own text
+    if (errIsStatic(err)) {
+        return (char *) (uintptr_t) err;
+    }
+
     // Look up the error entry and validate it, just to be defensive
     uint16_t entry = errorEntryFromError(err);
     if (entry >= MAXCONCURRENTERRORS) {
@@ -122,25 +404,36 @@ char *errString(err_t err)
 
     // Get the error text.  Note that even if the errorText buffer wrapped, we will end up with safe
     // output here even if it will be contextually inaccurate.  That said, we code defensively.
-    if (errors[entry].errorTextOffset >= MAXCONCURRENTERRORTEXT) {
+    errorEntry_t *e = &errors[entry];
+    if (e->errorTextOffset >= MAXCONCURRENTERRORTEXT) {
         mutexUnlock(&errorMutex);
         return "error table corruption";
     }
     errorText[sizeof(errorText)-1] = '\0';
 
-    // All valid error strings either begin at the start of the buffer, or are immediately following
-    // a prior null-terminated error string.  This allows us to detect circular overlap.
-    if (errors[entry].errorTextOffset > 0)
-        if (errorText[errors[entry].errorTextOffset-1] != '\0') {
-            mutexUnlock(&errorMutex);
-            return "an unknown error occurred (high error rate)";
-        }
+    // Detect text that has been overwritten because of a high rate of errors
+    if (errTextOverwritten(e)) {
+        mutexUnlock(&errorMutex);
+        return "an unknown error occurred (high error rate)";
+    }
+
+    // Format the text if it hasn't yet been formatted, replacing the packed arguments
+    if (e->format != NULL) {
+        char buffer[MAXERRSTRING];
+        errFormatArgs(e->format, (uint8_t *) &errorText[e->errorTextOffset], buffer, sizeof(buffer));
+        uint32_t len;
+        e->errorTextOffset = errTextInsert(buffer, &len);
+        e->errorTextLen = len;
+        e->errorTextLap = errorTextLap;
+        e->format = NULL;
+        errorTextNext = e->errorTextOffset + len;
+    }
 
     // Release
     mutexUnlock(&errorMutex);
 
     // Done
-    return (&errorText[errors[entry].errorTextOffset]);
+    return (&errorText[e->errorTextOffset]);
 
 }
 
@@ -4,12 +4,14 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
 #include "amd5.h"
+#include "ktrace.h"
 
 #pragma once
 
@@ -124,12 +126,50 @@ size_t strlcat(char *dst, const char *src, size_t siz);
 typedef int32_t err_t;
 #define MAXERRSTRING 256
 #define errNone ((err_t)0)
+// Static errors are the address of their literal text in flash, and cost nothing to raise.
+// Host builds have no flash to tell them by, and so raise them as ordinary errors.
+#if defined(__ICCARM__) || defined(__arm__)
+#define errStatic(msg) ((err_t) (uintptr_t) ("" msg))
+#else
+#define errStatic(msg) errF("%s", "" msg)
+#endif
 err_t errF(const char *format, ...);
 err_t errBody(err_t err, uint8_t **retBody, uint32_t *retBodyLen);
 bool errContains(err_t err, const char *errkey);
 char *errString(err_t err);
 
 // debug.c
+// Leveled debug output.  Calls above DEBUG_LEVEL are removed at compile time along with their
+// arguments and format strings, and the rest are output only if their module is enabled at
+// that level, which may be changed at runtime with the "trace" diag command.
+#define DEBUG_LEVEL_ERROR   0
+#define DEBUG_LEVEL_WARN    1
+#define DEBUG_LEVEL_INFO    2
+#define DEBUG_LEVEL_TRACE   3
+#define DEBUG_LEVELS        4
+#define DEBUG_LEVEL_OFF     -1
+#ifndef DEBUG_LEVEL
+#define DEBUG_LEVEL         DEBUG_LEVEL_TRACE
+#endif
+#define DEBUG_APP           0x0001
+#define DEBUG_SERIAL        0x0002
+#define DEBUG_MUTEX         0x0004
+#define DEBUG_TASK          0x0008
+#define DEBUG_TIMER         0x0010
+#define DEBUG_MEM           0x0020
+#define DEBUG_REQ           0x0040
+#define DEBUG_ALL           0xffffffff
+extern uint32_t debugModuleMask[DEBUG_LEVELS];
+#define debugOn(level, module) ((level) <= DEBUG_LEVEL && (debugModuleMask[level] & (module)) != 0)
+#define debugLog(level, module, ...) do { if (debugOn(level, module)) { debugf(__VA_ARGS__); } } while (0)
+#define debugError(module, ...) debugLog(DEBUG_LEVEL_ERROR, module, __VA_ARGS__)
+#define debugWarn(module, ...) debugLog(DEBUG_LEVEL_WARN, module, __VA_ARGS__)
+#define debugInfo(module, ...) debugLog(DEBUG_LEVEL_INFO, module, __VA_ARGS__)
+#define debugTrace(module, ...) debugLog(DEBUG_LEVEL_TRACE, module, __VA_ARGS__)
+uint32_t debugModuleByName(const char *name);
+err_t debugLevelByName(const char *name, int *level);
+void debugSetModuleLevel(uint32_t modules, int level);
+void debugModuleLevels(void);
 void debugBreakpoint(void);
 void debugf(const char *format, ...);
 void debugR(const char *format, ...);
@@ -141,6 +181,8 @@ void debugPause(void);
 bool debugIsPaused(void);
 void debugResume(void);
 void debugResumeForce(void);
+void debugBinary(bool on);
+bool debugIsBinary(void);
 
 // gmem.c
 extern long memObjects;
@@ -152,6 +194,24 @@ err_t memAlloc(uint32_t length, void *ptr);
 void memFree(void *p);
 err_t memRealloc(uint32_t fromLength, uint32_t toLength, void *ptr);
 err_t memDup(void *pSrc, uint32_t srcLength, void *pCopy);
+typedef struct {
+    uint8_t *base;
+    uint32_t size;
+    uint32_t used;
+    uint32_t highWater;         // Since last reset
+    uint32_t peak;              // Since init
+    uint32_t lastOffset;
+    uint32_t lastLength;
+    uint32_t failures;
+} memArena;
+err_t memArenaInit(memArena *arena, uint32_t size);
+void memArenaReset(memArena *arena);
+err_t memArenaAlloc(memArena *arena, uint32_t length, void *ptr);
+err_t memArenaRealloc(memArena *arena, uint32_t fromLength, uint32_t toLength, void *ptr);
+void memArenaFree(memArena *arena, void *p);
+bool memArenaOwns(memArena *arena, void *p);
+#define memArenaUsed(arena) ((arena)->used)
+#define memArenaHighWater(arena) ((arena)->highWater)
 
 // loc.c
 bool locSet(double lat, double lon, uint32_t ltime);
@@ -166,8 +226,15 @@ uint32_t timeSecsBoot(void);
 void timerSetBootTime(void);
 int64_t timerMs(void);
 int64_t timerMsFromISR(void);
+uint64_t timerCycles(void);
+int64_t timerUs(void);
+uint32_t timerCyclesPerUs(void);
+int64_t timerCyclesToUs(uint64_t cycles);
+int64_t timerCyclesToNs(uint64_t cycles);
+uint64_t timerUsToCycles(int64_t us);
 void timerMsDelay(uint32_t ms);
 void timerMsSleep(uint32_t ms);
+void timerMsSleepSlack(uint32_t ms, uint32_t slackMs);
 bool timerMsElapsed(int64_t began, uint32_t ms);
 uint32_t timerMsUntil(int64_t suppressionTimerMs);
 bool timeSetIfBetter(uint32_t newTimeSecs);
@@ -189,12 +256,19 @@ typedef struct {
     uint16_t size;
     uint16_t chunksize;
     uint16_t cachedIndex;
+    uint16_t growthPercent;
+    uint32_t growthMax;
     uint32_t length;
     uint32_t allocated;
     void *address;
     void *cachedAddress;
     arrayEntryReset_t resetFn;
     arrayEntryIsLess_t isLessFn;
+    memArena *arena;
+    bool indexed;
+    uint16_t offsetsCount;
+    uint16_t offsetsAllocated;
+    uint16_t *offsets;
 } array;
 #define arrayString array
 typedef struct {
@@ -202,31 +276,42 @@ typedef struct {
     array *name;
     array *value1;
     array *value2;
+    bool hashed;
+    bool hashCaseFold;
+    uint32_t hashSlots;
+    uint16_t *hashTable;
 } arrayMap;
 #define arrayEntries(ctx) ((ctx)->count)
 #define arrayLength(ctx) ((ctx)->length)
 #define arrayAddress(ctx) ((ctx)->address)
+#define arrayCapacity(ctx) ((ctx)->allocated)
 #define arrayAllocString(x) arrayAlloc(0, NULL, x)
 #define arrayAllocBytes(x) arrayAlloc(0, NULL, x)
 err_t arrayInsert(array *ctx, uint16_t i, void *data);
 void arrayRemove(array *ctx, uint16_t i);
 err_t arraySet(array *ctx, int index, void *data);
 void arrayShrink(array *ctx);
-err_t arrayAppendBytes(array *ctx, void *data, uint16_t datalen);
+err_t arrayReserve(array *ctx, uint32_t bytes);
+void arrayGrowth(array *ctx, uint16_t chunksize, uint16_t growthPercent, uint32_t growthMax);
+err_t arrayIndexStrings(array *ctx);
+err_t arrayAppendBytes(array *ctx, void *data, uint32_t datalen);
 err_t arrayAppendStringBytes(array *ctx, char *data);
 err_t arrayAppendStringTerminate(array *ctx);
 err_t arrayAppend(array *ctx, void *data);
 void arrayResetEntry(array *ctx, int i);
 void arrayReset(array *ctx);
 err_t arrayAlloc(uint16_t fixedsize, arrayEntryReset_t entryReset, array **ctx);
+err_t arrayAllocArena(memArena *arena, uint16_t fixedsize, arrayEntryReset_t entryReset, array **ctx);
 err_t arrayDup(array *ctx, array **dupCtx);
 void arrayFree(array *ctx);
 void *arrayFreeDetach(array *ctx);
 void *arrayFreeDetachDup(array *ctx);
 err_t arraySort(array *ctx);
+err_t arraySortIndex(array *ctx, uint16_t *index);
 void *arrayEntry(array *ctx, int index);
 err_t arrayMapAlloc(uint16_t fixedsize1, arrayEntryReset_t entryReset1, uint16_t fixedsize2, arrayEntryReset_t entryReset2, arrayMap **ctx);
 void arrayMapShrink(arrayMap *map);
+err_t arrayMapIndex(arrayMap *map, bool caseSensitive);
 err_t arrayMapDup(arrayMap *in, arrayMap **out);
 void arrayMapFree(arrayMap *map);
 void arrayMapFreeDetachValue(arrayMap *map, array **value1, array **value2);
@@ -239,6 +324,24 @@ err_t arraySplitString(array *ctx, char sep);
 void arrayClear(array *ctx);
 void arrayMapClear(arrayMap *ctx);
 
+// fmt.c
+#define FMT_ARG_INT     0
+#define FMT_ARG_LONG    1
+#define FMT_ARG_LLONG   2
+#define FMT_ARG_SIZE    3
+#define FMT_ARG_DOUBLE  4
+#define FMT_ARG_PTR     5
+#define FMT_ARG_STR     6
+#define FMT_PRECISION_NONE  -1
+#define FMT_PRECISION_ARG   -2
+uint32_t fmtConversion(const char *p, uint32_t *stars, uint32_t *argType, int *precision);
+typedef void (*fmtSink_t) (void *sinkCtx, const char *buf, uint32_t len);
+uint32_t fmtV(fmtSink_t sink, void *sinkCtx, const char *format, va_list args);
+uint32_t fmtPrint(fmtSink_t sink, void *sinkCtx, const char *format, ...);
+uint32_t fmtStringV(char *buf, uint32_t buflen, const char *format, va_list args);
+uint32_t fmtString(char *buf, uint32_t buflen, const char *format, ...);
+err_t fmtArray(array *ctx, const char *format, ...);
+
 // float16.c
 typedef uint16_t float16_t;
 float16_t float16FromFloat32(float x);
@@ -260,6 +363,7 @@ uint32_t randEvenDistribution(uint32_t n);
 #define prandUint64() ((((uint64_t)prandNumber()) << 32LL) | ((uint64_t)prandNumber()))
 
 // task.c
+#define TASK_TLS_INDEX 0                // Thread local storage slot holding the task ID plus one
 void taskRegister(int taskID, char *name, char letter, uint32_t stackBytes);
 void taskRegisterAsNonBlocking(int taskID);
 char *taskLabel(int taskID);
@@ -268,9 +372,24 @@ int taskID(void);
 uint32_t taskAllIdleForMs(bool trace);
 #define TASK_WAIT_FOREVER 0xffffffff
 bool taskTake(int taskID, uint32_t timeoutMs);
+bool taskTakeSlack(int taskID, uint32_t timeoutMs, uint32_t slackMs);
+void taskSleep(uint32_t ms, uint32_t slackMs);
+void taskWakeupStats(void);
+#define TASK_IDLE_SLACK_MS ms1Min       // Slack for the hourly timeouts of tasks waiting for work
 void taskGive(int taskID);
 void taskGiveFromISR(int taskID);
 void taskGiveAllFromISR(void);
+// Events that tasks may subscribe to with taskSubscribe()
+#define TASK_EVENT_PORT_USB         0x00000001  // A request is ready on a port
+#define TASK_EVENT_PORT_LPUART1     0x00000002
+#define TASK_EVENT_PORT_USART1      0x00000004
+#define TASK_EVENT_PORT_USART2      0x00000008
+#define TASK_EVENT_PORTS            0x0000000F
+#define TASK_EVENT_USB_CHANGE       0x00000010  // USB was connected or disconnected
+void taskSubscribe(int taskID, uint32_t events);
+void taskSignal(uint32_t events);
+void taskSignalFromISR(uint32_t events);
+uint32_t taskTakeEvents(int taskID, uint32_t timeoutMs, uint32_t slackMs);
 void taskSuspend(void);
 void taskResume(void);
 void taskStackStats();
@@ -285,9 +404,57 @@ void tssPause(void);
 void tssResume(void);
 void tssStats(void);
 
+// prof.c
+// Host builds, which have no DWT, time with the monotonic clock instead
+#if !defined(__ICCARM__) && !defined(__arm__)
+#define PROF_HOST
+#endif
+// Cycle-counting probes.  PROF_SCOPE(name) { ... } times the block that follows it, which must be
+// left by falling off its end rather than by return, break or goto.  Where a function has several
+// exits, PROF_BEGIN(name) at its top and PROF_END(name) before each return do the same.
+#ifndef PROF_ENABLED
+#define PROF_ENABLED        1
+#endif
+typedef struct {
+    const char *name;
+    bool registered;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profSite;
+#if PROF_ENABLED
+#define PROF_SCOPE(name) \
+    static profSite name##ProfSite = {#name}; \
+    for (uint32_t name##ProfBegan = profCycles(), name##ProfOnce = 1; name##ProfOnce != 0; name##ProfOnce = 0, profRecord(&name##ProfSite, name##ProfBegan))
+#define PROF_BEGIN(name) \
+    static profSite name##ProfSite = {#name}; \
+    uint32_t name##ProfBegan = profCycles()
+#define PROF_END(name) profRecord(&name##ProfSite, name##ProfBegan)
+#else
+#define PROF_SCOPE(name)
+#define PROF_BEGIN(name)
+#define PROF_END(name) ((void) 0)
+#endif
+void profInit(void);
+uint32_t profCycles(void);
+void profRecord(profSite *site, uint32_t beganCycles);
+void profReset(void);
+void profStats(void);
+
+// cpu.c
+void cpuRunTimeInit(void);
+uint32_t cpuRunTimeCounter(void);
+void cpuSleptMs(uint32_t ms);
+void cpuSample(void);
+void cpuTop(void);
+
 // memmem.c
 void *memmem(const void *h0, size_t k, const void *n0, size_t l);
 
+// civil.c
+int64_t civilDaysFromDate(int year, int mon1, int day1);
+
 // crc16.c
 uint16_t crc16(uint8_t const *data, size_t size);
 
@@ -18,14 +18,17 @@ uint32_t memCurrentlyFree(void)
 // Alloc
 err_t memAlloc(uint32_t length, void *ptr)
 {
+    PROF_BEGIN(memAlloc);
     void *p = pvPortMalloc((size_t)length);
     if (p == NULL) {
         memFailures++;
+        PROF_END(memAlloc);
         return errF("cannot allocate %d bytes " ERR_MEM_ALLOC, length);
     }
     memObjects++;
     memset(p, 0, length);
     * (void **) ptr = p;
+    PROF_END(memAlloc);
     return errNone;
 }
 
@@ -70,3 +73,102 @@ err_t memDup(void *pSrc, uint32_t srcLength, void *pCopy)
     * (void **) pCopy = copy;
     return errNone;
 }
+
+// Arena allocations are rounded up so that any object may be placed within them
+#define ARENA_ALIGN(x) (((x) + 7) & ~((uint32_t)7))
+
+// Allocate the backing store for an arena.  This is done once, typically at init, so that
+// the arena's buffer is a single long-lived heap object that never fragments the heap.
+err_t memArenaInit(memArena *arena, uint32_t size)
+{
+    memset(arena, 0, sizeof(memArena));
+    size = ARENA_ALIGN(size);
+    err_t err = memAlloc(size, &arena->base);
+    if (err) {
+        return err;
+    }
+    arena->size = size;
+    return errNone;
+}
+
+// Release everything allocated from an arena in a single operation
+void memArenaReset(memArena *arena)
+{
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    arena->used = 0;
+    arena->highWater = 0;
+    arena->lastOffset = 0;
+    arena->lastLength = 0;
+}
+
+// Allocate from an arena, which is nothing more than a pointer increment.  As with memAlloc,
+// the memory is guaranteed to be zeroed.
+err_t memArenaAlloc(memArena *arena, uint32_t length, void *ptr)
+{
+    uint32_t alignedLength = ARENA_ALIGN(length);
+    if (arena->base == NULL || alignedLength > (arena->size - arena->used)) {
+        arena->failures++;
+        return errF("cannot allocate %d bytes from arena " ERR_MEM_ALLOC, length);
+    }
+    uint8_t *p = &arena->base[arena->used];
+    memset(p, 0, length);
+    arena->lastOffset = arena->used;
+    arena->lastLength = alignedLength;
+    arena->used += alignedLength;
+    if (arena->used > arena->highWater) {
+        arena->highWater = arena->used;
+    }
+    * (void **) ptr = p;
+    return errNone;
+}
+
+// Resize an arena allocation, growing in place if it was the most recent one
+err_t memArenaRealloc(memArena *arena, uint32_t fromLength, uint32_t toLength, void *ptr)
+{
+    uint8_t *old = * (void **) ptr;
+    if (old != NULL && old == &arena->base[arena->lastOffset] && arena->lastLength != 0) {
+        uint32_t alignedLength = ARENA_ALIGN(toLength);
+        if (alignedLength <= (arena->size - arena->lastOffset)) {
+            if (toLength > fromLength) {
+                memset(&old[fromLength], 0, toLength - fromLength);
+            }
+            arena->used = arena->lastOffset + alignedLength;
+            arena->lastLength = alignedLength;
+            if (arena->used > arena->highWater) {
+                arena->highWater = arena->used;
+            }
+            return errNone;
+        }
+    }
+    uint8_t *new;
+    err_t err = memArenaAlloc(arena, toLength, &new);
+    if (err) {
+        return err;
+    }
+    if (old != NULL) {
+        memcpy(new, old, GMIN(toLength, fromLength));
+    }
+    * (void **) ptr = new;
+    return errNone;
+}
+
+// Free an arena allocation.  This is a no-op unless it is the most recent allocation,
+// in which case its space is returned so that short-lived temporaries cost nothing.
+void memArenaFree(memArena *arena, void *p)
+{
+    if (p != NULL && p == &arena->base[arena->lastOffset] && arena->lastLength != 0) {
+        arena->used = arena->lastOffset;
+        arena->lastLength = 0;
+    }
+}
+
+// See if an object was allocated from the specified arena
+bool memArenaOwns(memArena *arena, void *p)
+{
+    if (arena == NULL || arena->base == NULL) {
+        return false;
+    }
+    return ((uint8_t *)p >= arena->base && (uint8_t *)p < &arena->base[arena->size]);
+}
@@ -0,0 +1,155 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "global.h"
+#include "job.h"
+
+// A FIFO of queued jobs per priority, linked through the jobs themselves.  Jobs are posted from
+// both tasks and ISRs, so the queues are only touched with interrupts masked.
+STATIC job *jobHead[JOB_PRIORITIES] = {0};
+STATIC job *jobTail[JOB_PRIORITIES] = {0};
+
+// Initialize a job that wasn't statically initialized with JOB_INIT
+void jobInit(job *j, jobFunc func, void *arg, uint32_t priority)
+{
+    memset(j, 0, sizeof(job));
+    j->func = func;
+    j->arg = arg;
+    j->priority = (uint8_t) GMIN(priority, JOB_PRIORITIES-1);
+}
+
+// Append a job to the queue for its priority unless it's already queued.  Returns true if it
+// was queued.
+STATIC bool jobEnqueue(job *j)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool queued = !j->queued;
+    if (queued) {
+        uint32_t pri = GMIN(j->priority, JOB_PRIORITIES-1);
+        j->queued = true;
+        j->next = NULL;
+        if (jobTail[pri] == NULL) {
+            jobHead[pri] = j;
+        } else {
+            jobTail[pri]->next = j;
+        }
+        jobTail[pri] = j;
+    }
+    __set_PRIMASK(primask);
+    return queued;
+}
+
+// Remove the first job of the highest priority that has one, or return NULL if none are queued
+STATIC job *jobDequeue(void)
+{
+    job *j = NULL;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t pri=0; pri<JOB_PRIORITIES; pri++) {
+        j = jobHead[pri];
+        if (j != NULL) {
+            jobHead[pri] = j->next;
+            if (jobHead[pri] == NULL) {
+                jobTail[pri] = NULL;
+            }
+            j->next = NULL;
+            j->queued = false;
+            break;
+        }
+    }
+    __set_PRIMASK(primask);
+    return j;
+}
+
+// Queue a job to run as soon as the job task gets to it.  Returns false if it was already queued.
+bool jobPost(job *j)
+{
+    if (!jobEnqueue(j)) {
+        return false;
+    }
+    taskGive(TASKID_JOB);
+    return true;
+}
+
+// Queue a job from an ISR.  Returns false if it was already queued.
+bool jobPostFromISR(job *j)
+{
+    if (!jobEnqueue(j)) {
+        return false;
+    }
+    taskGiveFromISR(TASKID_JOB);
+    return true;
+}
+
+// Timer server callback for a delayed job, called at ISR level
+STATIC void jobTimerExpired(void *arg)
+{
+    jobPostFromISR((job *) arg);
+}
+
+// Queue a job after a delay, replacing any delay already pending for it.  The delay is kept by
+// the timer server, so it is honored across STOP2.
+void jobPostDelayed(job *j, uint32_t delayMs)
+{
+    if (delayMs == 0) {
+        jobPost(j);
+        return;
+    }
+    if (!j->timerCreated) {
+        UTIL_TIMER_Create(&j->timer, delayMs, UTIL_TIMER_ONESHOT, jobTimerExpired, j);
+        j->timerCreated = true;
+    }
+    UTIL_TIMER_StartWithPeriod(&j->timer, delayMs);
+}
+
+// Cancel a job's pending delay and remove it from its queue if it's queued
+void jobCancel(job *j)
+{
+    if (j->timerCreated) {
+        UTIL_TIMER_Stop(&j->timer);
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (j->queued) {
+        uint32_t pri = GMIN(j->priority, JOB_PRIORITIES-1);
+        job *prev = NULL;
+        for (job *cur = jobHead[pri]; cur != NULL; prev = cur, cur = cur->next) {
+            if (cur == j) {
+                if (prev == NULL) {
+                    jobHead[pri] = j->next;
+                } else {
+                    prev->next = j->next;
+                }
+                if (jobTail[pri] == j) {
+                    jobTail[pri] = prev;
+                }
+                break;
+            }
+        }
+        j->next = NULL;
+        j->queued = false;
+    }
+    __set_PRIMASK(primask);
+}
+
+// See whether a job is queued or waiting on its delay
+bool jobIsPending(job *j)
+{
+    return j->queued || (j->timerCreated && UTIL_TIMER_IsRunning(&j->timer));
+}
+
+// Job task, running queued jobs highest priority first, each to completion
+void jobTask(void *params)
+{
+    while (true) {
+        job *j = jobDequeue();
+        if (j == NULL) {
+            taskTakeSlack(TASKID_JOB, ms1Hour, TASK_IDLE_SLACK_MS);
+            continue;
+        }
+        j->func(j->arg);
+    }
+}
@@ -0,0 +1,39 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32_timer.h"
+
+// This file was split out from global.h because jobs embed a timer from the timer server.
+// Jobs are short run-to-completion reactions that all run on the one job task's stack, so that
+// work such as button handling and LED patterns doesn't need a task of its own.  A job must not
+// block; to wait, it posts itself or another job delayed.  Jobs are statically allocated and
+// posting a job that is already queued does nothing, so that bursts of events coalesce.
+#define JOB_PRI_HIGH        0
+#define JOB_PRI_NORMAL      1
+#define JOB_PRI_LOW         2
+#define JOB_PRIORITIES      3
+typedef void (*jobFunc)(void *arg);
+typedef struct job_s {
+    jobFunc func;
+    void *arg;
+    uint8_t priority;
+    volatile bool queued;
+    bool timerCreated;
+    struct job_s *next;
+    UTIL_TIMER_Object_t timer;
+} job;
+#define JOB_INIT(func, arg, priority) {(func), (arg), (priority), false, false, NULL, {0}}
+
+// job.c
+void jobInit(job *j, jobFunc func, void *arg, uint32_t priority);
+bool jobPost(job *j);
+bool jobPostFromISR(job *j);
+void jobPostDelayed(job *j, uint32_t delayMs);
+void jobCancel(job *j);
+bool jobIsPending(job *j);
+void jobTask(void *params);
@@ -0,0 +1,107 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "global.h"
+
+// Kernel events and serial markers are recorded into this ring, overwriting the oldest, so that
+// after a stall the "ktrace" diag command can show how the time leading up to it was spent.
+// Recording is off until "ktrace on", or from boot if KTRACE_AT_BOOT is defined as 1.  Each
+// record is timestamped with the microsecond run time counter, which continues across STOP2.  The
+// layout is decoded by Tools/ktrace2json.py, so it must not change.
+#ifndef KTRACE_RECORDS
+#define KTRACE_RECORDS      128
+#endif
+#ifndef KTRACE_AT_BOOT
+#define KTRACE_AT_BOOT      0
+#endif
+#define KTRACE_MAX_TASKS    8
+#define KTRACE_PER_LINE     4
+typedef struct {
+    uint32_t us;
+    uint8_t event;
+    uint8_t task;               // Task number of the running task
+    uint16_t irq;               // Exception number if in an ISR, else 0
+    uint32_t arg;
+} ktraceEntry;
+STATIC ktraceEntry ktraceRing[KTRACE_RECORDS];
+STATIC uint32_t ktraceWritten = 0;
+STATIC volatile bool ktraceEnabled = KTRACE_AT_BOOT;
+
+// Record an event.  This is called from kernel trace hooks, in critical sections and ISRs, so it
+// does nothing but fill in the next record with interrupts masked.
+void ktraceRecord(uint32_t event, uint32_t arg)
+{
+    if (!ktraceEnabled) {
+        return;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ktraceEntry *e = &ktraceRing[ktraceWritten++ % KTRACE_RECORDS];
+    e->us = cpuRunTimeCounter();
+    e->event = (uint8_t) event;
+    e->task = (uint8_t) uxTaskGetTaskNumber(xTaskGetCurrentTaskHandle());
+    e->irq = (uint16_t) __get_IPSR();
+    e->arg = arg;
+    __set_PRIMASK(primask);
+}
+
+// Record a queue event, distinguishing mutexes from other queues and semaphores
+void ktraceQueue(uint32_t event, uint8_t queueType, void *queue)
+{
+    if (queueType == queueQUEUE_TYPE_MUTEX || queueType == queueQUEUE_TYPE_RECURSIVE_MUTEX) {
+        event = event - KTRACE_QUEUE_BLOCK + KTRACE_MUTEX_BLOCK;
+    }
+    ktraceRecord(event, (uint32_t) (uintptr_t) queue);
+}
+
+// Enable or disable recording
+void ktraceEnable(bool enable)
+{
+    ktraceEnabled = enable;
+}
+
+// Discard everything recorded
+void ktraceClear(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ktraceWritten = 0;
+    __set_PRIMASK(primask);
+}
+
+// Dump the ring to the debug port, oldest first, as lines that Tools/ktrace2json.py picks out of
+// a capture: the task names, and then the raw records in base64.  Recording is paused meanwhile
+// so that the dump doesn't record itself.
+void ktraceDump(void)
+{
+    bool wasEnabled = ktraceEnabled;
+    ktraceEnabled = false;
+
+    // Header and task names
+    uint32_t count = GMIN(ktraceWritten, KTRACE_RECORDS);
+    uint32_t first = ktraceWritten - count;
+    debugR("ktrace begin %lu %lu\n", (unsigned long) count, (unsigned long) first);
+    TaskStatus_t status[KTRACE_MAX_TASKS];
+    UBaseType_t tasks = uxTaskGetSystemState(status, KTRACE_MAX_TASKS, NULL);
+    for (UBaseType_t i=0; i<tasks; i++) {
+        debugR("ktrace task %lu %s\n", (unsigned long) status[i].xTaskNumber, status[i].pcTaskName);
+    }
+
+    // Records, flushing each line so that the dump isn't dropped by the debug output buffer
+    for (uint32_t i=0; i<count; i+=KTRACE_PER_LINE) {
+        ktraceEntry entries[KTRACE_PER_LINE];
+        uint32_t n = GMIN(count - i, KTRACE_PER_LINE);
+        for (uint32_t j=0; j<n; j++) {
+            entries[j] = ktraceRing[(first + i + j) % KTRACE_RECORDS];
+        }
+        char line[((sizeof(entries) + 2) / 3) * 4 + 1];
+        Base64encode(line, (const char *) entries, n * sizeof(ktraceEntry));
+        debugR("ktrace data %s\n", line);
+        MX_DBG_Flush();
+    }
+    debugR("ktrace end\n");
+
+    ktraceEnabled = wasEnabled;
+}
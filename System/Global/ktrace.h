@@ -0,0 +1,32 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// This file was split out from global.h because it is also included by FreeRTOSConfig.h, whose
+// trace hook macros record kernel events.  Tools/ktrace2json.py decodes these codes, so they
+// must only ever be appended to.
+#define KTRACE_SWITCH           1       // A task was switched in
+#define KTRACE_MUTEX_BLOCK      2       // The task blocked waiting for a mutex (arg is the mutex)
+#define KTRACE_MUTEX_TAKE       3       // The task took a mutex
+#define KTRACE_MUTEX_GIVE       4       // The task gave a mutex
+#define KTRACE_QUEUE_BLOCK      5       // The task blocked waiting on a queue or semaphore
+#define KTRACE_QUEUE_RECEIVE    6       // The task received from a queue or took a semaphore
+#define KTRACE_QUEUE_SEND       7       // The task sent to a queue or gave a semaphore
+#define KTRACE_NOTIFY           8       // A task was notified (arg is its task number)
+#define KTRACE_NOTIFY_BLOCK     9       // The task blocked waiting for a notification
+#define KTRACE_NOTIFY_TAKE      10      // The task took a notification
+#define KTRACE_SLEEP            11      // The MCU woke from STOP2 (arg is the ms slept)
+#define KTRACE_RX_COMPLETE      32      // Serial receive complete (arg is the byte count)
+#define KTRACE_RX_NOTIFY        33      // Serial receive notification (arg is error, or 1<<31 if overrun)
+
+// ktrace.c
+void ktraceRecord(uint32_t event, uint32_t arg);
+void ktraceQueue(uint32_t event, uint8_t queueType, void *queue);
+void ktraceEnable(bool enable);
+void ktraceClear(void);
+void ktraceDump(void);
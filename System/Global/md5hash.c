@@ -25,9 +25,12 @@ void md5HashToString(uint8_t *data, uint32_t len, char *strbuf, uint32_t buflen)
 // Convert MD5 binary to string into a buffer that is at least MD5_HEX_STRING_SIZE in length
 void md5BinaryToString(uint8_t *hash, char *strbuf, uint32_t buflen)
 {
-    char hashstr[MD5_SIZE*3] = {0};
+    static const char hexdigits[] = "0123456789abcdef";
+    char hashstr[MD5_SIZE*2+1];
     for (int i=0; i<MD5_SIZE; i++) {
-        snprintf((char *)&hashstr[i*2], 5, "%02x", hash[i]);
+        hashstr[i*2] = hexdigits[hash[i] >> 4];
+        hashstr[i*2+1] = hexdigits[hash[i] & 0x0f];
     }
+    hashstr[MD5_SIZE*2] = '\0';
     strlcpy(strbuf, hashstr, buflen);
 }
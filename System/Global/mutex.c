@@ -10,7 +10,7 @@
 #define MUTEX_HELD_DURATION_WARNING_MS      500
 #define MUTEX_NEEDED_DURATION_WARNING_MS    100
 #define SHOW_MUTEX_DURATION_WARNINGS        false
-#define SHOW_MUTEX_LOCKS                    false
+#define MUTEX_TIMED                         (mutexContention || (mutexTrace && SHOW_MUTEX_DURATION_WARNINGS))
 #define debugMessage(x)                     MX_DBG(x, strlen(x))
 
 // Note that we cannot use these in here because we'd go recursive
@@ -27,19 +27,56 @@
 STATIC mtxtype_t taskMutexes[TASKID_NUM_TASKS] = {0};
 #endif
 
-// The mutex to protect mutex creation
-STATIC mutex initMutex = {MTX_MTX, {0}};
+// Contention statistics, when compiled in with mutexContention, kept per mutex type rather than
+// per mutex because it's the type that tells us which subsystem is the bottleneck.  Each mutex
+// caches the slot of its type.  Mutexes of a type may be held at once by different tasks, so the
+// counters are atomics rather than being updated with interrupts masked.  Totals are 32 bits of
+// microseconds, so they wrap after 71 minutes of waiting or holding; use "locks reset".
+#if mutexContention
+#define MUTEX_STAT_SLOTS    16
+#define MUTEX_STAT_NONE     0xff
+typedef struct {
+    mtxtype_t mtx;
+    atomic_uint acquisitions;
+    atomic_uint contended;
+    atomic_uint waitMaxUs;
+    atomic_uint holdMaxUs;
+    atomic_uint waitTotalUs;
+    atomic_uint holdTotalUs;
+} mutexStat;
+STATIC mutexStat mutexStatTable[MUTEX_STAT_SLOTS];
+STATIC uint32_t mutexStatSlots = 0;
+#endif
+
+// A mutex used only to measure the cost of locking.  Its type is 0 so that it is exempt from
+// ordering checks, whatever the caller holds.
+#define MUTEX_BENCHMARK_ITERATIONS  1000
+STATIC mutex benchmarkMutex = {0, {0}};
 
 // Forwards
 char *justFilename(const char *fileName);
 
+// Create a mutex's semaphore within the mutex itself.  Mutexes that are statically initialized
+// to {0} rather than by mutexInit() are created on first lock, when two tasks may race to create
+// them, so this is done in a critical section, which is safe because static creation neither
+// allocates nor blocks.
+STATIC void mutexCreate(mutex *m)
+{
+    taskENTER_CRITICAL();
+    if (!m->state.initialized) {
+        m->state.handle = xSemaphoreCreateMutexStatic(&m->state.buffer);
+        m->state.lockedTask = -1;
+        m->state.initialized = true;
+    }
+    taskEXIT_CRITICAL();
+}
+
 // Init a mutex
 void mutexInit(mutex *m, mtxtype_t mtype)
 {
     memset(m, 0, sizeof(mutex));
     m->mtx = mtype;
-    mutexLock(m);
-    mutexUnlock(m);
+    mutexCreate(m);
 }
 
 // For debugging, display which mutexes are owned by the current task.  Note that
@@ -50,11 +87,166 @@ void mutexDebugOwned(const char **name, int64_t *owned)
     *owned = 0;
     *name = "";
 #if mutexTrace
-    *name = taskLabel(taskID());
-    *owned = (int64_t) taskMutexes[taskID()];
+    int thisTaskID = taskID();
+    *name = taskLabel(thisTaskID);
+    *owned = (int64_t) taskMutexes[thisTaskID];
 #endif
 }
 
+#if mutexContention
+// Find or allocate the statistics slot for a mutex's type, caching it in the mutex.  Interrupts
+// are masked only the first time that each mutex is locked.
+STATIC mutexStat *mutexStatFor(mutex *m)
+{
+    if (m->state.statSlot == 0) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t slot;
+        for (slot=0; slot<mutexStatSlots; slot++) {
+            if (mutexStatTable[slot].mtx == m->mtx) {
+                break;
+            }
+        }
+        if (slot == mutexStatSlots && slot < MUTEX_STAT_SLOTS) {
+            mutexStatTable[slot].mtx = m->mtx;
+            mutexStatSlots++;
+        }
+        m->state.statSlot = (slot < MUTEX_STAT_SLOTS) ? slot+1 : MUTEX_STAT_NONE;
+        __set_PRIMASK(primask);
+    }
+    if (m->state.statSlot == MUTEX_STAT_NONE) {
+        return NULL;
+    }
+    return &mutexStatTable[m->state.statSlot-1];
+}
+
+// Raise a maximum, retrying if another task raised it at the same time.  The counters are only
+// statistics, so none of their updates need to be ordered with respect to other memory.
+STATIC void mutexStatMax(atomic_uint *max, uint32_t value)
+{
+    unsigned int seen = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(max, &seen, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Record an acquisition, and the time waited for it if it was contended
+STATIC void mutexStatAcquired(mutex *m, bool contended, uint32_t waitUs)
+{
+    mutexStat *stat = mutexStatFor(m);
+    if (stat == NULL) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stat->acquisitions, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&stat->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stat->waitTotalUs, waitUs, memory_order_relaxed);
+        mutexStatMax(&stat->waitMaxUs, waitUs);
+    }
+}
+
+// Record how long a mutex was held
+STATIC void mutexStatReleased(mutex *m, uint32_t holdUs)
+{
+    mutexStat *stat = mutexStatFor(m);
+    if (stat == NULL) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stat->holdTotalUs, holdUs, memory_order_relaxed);
+    mutexStatMax(&stat->holdMaxUs, holdUs);
+}
+
+// Name a mutex type for display
+STATIC const char *mutexTypeName(mtxtype_t mtx, char *buf, uint32_t buflen)
+{
+    switch (mtx) {
+    case 0:
+        return "external";
+    case MTX_MTX:
+        return "mtx";
+    case MTX_TIME:
+        return "time";
+    case MTX_EVENT:
+        return "event";
+    case MTX_QUEUE:
+        return "queue";
+    case MTX_RAND:
+        return "rand";
+    case MTX_ERR:
+        return "err";
+    case MTX_SERIAL_TX:
+        return "serial tx";
+    case MTX_SERIAL_RX:
+        return "serial rx";
+    }
+    snprintf(buf, buflen, "0x%llx", (unsigned long long) mtx);
+    return buf;
+}
+
+// Display contention statistics by mutex type
+void mutexStats(void)
+{
+    char line[128];
+    snprintf(line, sizeof(line), "%-12s %8s %8s %10s %8s %10s %8s\n", "mutex", "locks", "waited", "waitUs", "maxWait", "holdUs", "maxHold");
+    debugMessage(line);
+    for (uint32_t slot=0; slot<mutexStatSlots; slot++) {
+        mutexStat *stat = &mutexStatTable[slot];
+        char name[24];
+        snprintf(line, sizeof(line), "%-12s %8lu %8lu %10lu %8lu %10lu %8lu\n",
+                 mutexTypeName(stat->mtx, name, sizeof(name)),
+                 (unsigned long) atomic_load(&stat->acquisitions), (unsigned long) atomic_load(&stat->contended),
+                 (unsigned long) atomic_load(&stat->waitTotalUs), (unsigned long) atomic_load(&stat->waitMaxUs),
+                 (unsigned long) atomic_load(&stat->holdTotalUs), (unsigned long) atomic_load(&stat->holdMaxUs));
+        debugMessage(line);
+    }
+}
+
+// Reset contention statistics, leaving the slots assigned
+void mutexStatsReset(void)
+{
+    for (uint32_t slot=0; slot<mutexStatSlots; slot++) {
+        mutexStat *stat = &mutexStatTable[slot];
+        atomic_store(&stat->acquisitions, 0);
+        atomic_store(&stat->contended, 0);
+        atomic_store(&stat->waitTotalUs, 0);
+        atomic_store(&stat->waitMaxUs, 0);
+        atomic_store(&stat->holdTotalUs, 0);
+        atomic_store(&stat->holdMaxUs, 0);
+    }
+}
+
+#else
+
+// Contention statistics aren't compiled in
+void mutexStats(void)
+{
+    debugMessage("mutex contention statistics require mutexContention in mutex.h\n");
+}
+
+// Contention statistics aren't compiled in
+void mutexStatsReset(void)
+{
+}
+
+#endif
+
+// Measure the cycles taken by an uncontended lock and unlock, for the "prof mutex" diag command.
+// This includes whatever statistics and tracing are compiled in.  Locking has no profiling probe
+// of its own, because recording one would mask interrupts on every lock.
+void mutexBenchmark(void)
+{
+    mutexLock(&benchmarkMutex);
+    mutexUnlock(&benchmarkMutex);
+    uint32_t began = profCycles();
+    for (int i=0; i<MUTEX_BENCHMARK_ITERATIONS; i++) {
+        mutexLock(&benchmarkMutex);
+        mutexUnlock(&benchmarkMutex);
+    }
+    uint32_t cycles = (profCycles() - began) / MUTEX_BENCHMARK_ITERATIONS;
+    char line[80];
+    snprintf(line, sizeof(line), "mutex lock+unlock: %lu cycles\n", (unsigned long) cycles);
+    debugMessage(line);
+}
+
 // DeInit a mutex
 void mutexDeInit(mutex *m)
 {
@@ -72,27 +264,9 @@ void mutexLock(mutex *m)
 {
     int thisTaskID = taskID();
 
-    // First time through ANY mutex lock?
-    if (!initMutex.state.initialized) {
-        initMutex.state.handle = xSemaphoreCreateMutex();
-        if (initMutex.state.handle == NULL) {
-            debugPanic("can't allocate init mutex");
-        }
-        initMutex.state.initialized = true;
-    }
-
-    // First time through this mutex?
+    // First time through a mutex that wasn't initialized with mutexInit()?
     if (!m->state.initialized) {
-        xSemaphoreTake(initMutex.state.handle, portMAX_DELAY);
-        if (!m->state.initialized) {
-            m->state.handle = xSemaphoreCreateMutex();
-            if (m->state.handle == NULL) {
-                debugPanic("can't allocate mutex");
-            }
-            m->state.lockedTask = -1;
-            m->state.initialized = true;
-        }
-        xSemaphoreGive(initMutex.state.handle);
+        mutexCreate(m);
     }
 
     // Validate that we're not locking nested
@@ -106,29 +280,43 @@ void mutexLock(mutex *m)
 #endif
     }
 
-    // Take the mutex
+    // Take the mutex, timing the wait only if we have to wait for it
+    bool contended = !xSemaphoreTake(m->state.handle, 0);
+#if mutexContention
+    uint32_t waitBeganUs = contended ? cpuRunTimeCounter() : 0;
+#endif
 #if mutexTrace && SHOW_MUTEX_DURATION_WARNINGS
     int64_t timerBegan = timerMs();
-    while (!xSemaphoreTake(m->state.handle, MUTEX_NEEDED_DURATION_WARNING_MS)) {
+    while (contended && !xSemaphoreTake(m->state.handle, MUTEX_NEEDED_DURATION_WARNING_MS)) {
         char reason[128];
         uint32_t secsHeld = (uint32_t) (timerMs() - timerBegan)/1000;
         snprintf(reason, sizeof(reason), "$$$$ mutex needed by %s:%u (%d) is being held for %us by %s:%u (%d)\n", justFilename(filename), (unsigned)lineno, taskID(), secsHeld, justFilename(m->state.filename), m->state.lineno, m->state.lockedTask);
         debugMessage(reason);
     }
 #else
-    xSemaphoreTake(m->state.handle, portMAX_DELAY);
+    if (contended) {
+        xSemaphoreTake(m->state.handle, portMAX_DELAY);
+    }
+#endif
+#if MUTEX_TIMED
+    m->state.lockedUs = cpuRunTimeCounter();
+#endif
+#if mutexContention
+    mutexStatAcquired(m, contended, contended ? m->state.lockedUs - waitBeganUs : 0);
 #endif
 
-    // Trace
-#if SHOW_MUTEX_LOCKS
-    char reason[128];
-    snprintf(reason, sizeof(reason), "mutexLock: %s 0x%016llx %s:%u\n", taskLabel(thisTaskID), (unsigned long long)m->mtx, justFilename(filename), (unsigned)lineno);
-    debugMessage(reason);
+    // Trace, when enabled with "trace mutex trace", except for the locks taken while writing the
+    // trace itself to the debug port
+#if mutexTrace
+    if (debugOn(DEBUG_LEVEL_TRACE, DEBUG_MUTEX) && thisTaskID != TASKID_LOG) {
+        char reason[128];
+        snprintf(reason, sizeof(reason), "mutexLock: %s 0x%016llx %s:%u\n", taskLabel(thisTaskID), (unsigned long long)m->mtx, justFilename(filename), (unsigned)lineno);
+        debugMessage(reason);
+    }
 #endif
 
     // Remember the state of the underlying mutex, for debugging
     m->state.lockedTask = thisTaskID;
-    m->state.lockedMs = timerMs();
 
     // Do mutex ordering checking.  Note that we do allow mutex type to be 0 because
     // external packages such as lwip create mutexes and manage their own nesting.
@@ -170,12 +358,15 @@ bool mutexIsLocked(mutex *m, int *lockedTaskID)
 // Unlock the resource
 void mutexUnlock(mutex *m)
 {
+    int thisTaskID = taskID();
 
-    // Trace
-#if SHOW_MUTEX_LOCKS
-    char reason[128];
-    snprintf(reason, sizeof(reason), "mutexUnlock: %s 0x%016llx\n", taskLabel(taskID()), (unsigned long long)m->mtx);
-    debugMessage(reason);
+    // Trace, when enabled with "trace mutex trace"
+#if mutexTrace
+    if (debugOn(DEBUG_LEVEL_TRACE, DEBUG_MUTEX) && thisTaskID != TASKID_LOG) {
+        char reason[128];
+        snprintf(reason, sizeof(reason), "mutexUnlock: %s 0x%016llx\n", taskLabel(thisTaskID), (unsigned long long)m->mtx);
+        debugMessage(reason);
+    }
 #endif
 
     if (m->state.lockedTask == -1) {
@@ -187,25 +378,28 @@ void mutexUnlock(mutex *m)
         debugPanic("*** mutexUnlock of unlocked mutex!");
 #endif
     }
-    if (m->state.lockedTask != taskID()) {
+    if (m->state.lockedTask != thisTaskID) {
 #if mutexTrace
         char reason[128];
-        snprintf(reason, sizeof(reason), "*** mutexUnlock of mutex owned by another task! (cur:%d owner:%d)  %s:%u\n", taskID(), m->state.lockedTask, justFilename(m->state.filename), (unsigned)m->state.lineno);
+        snprintf(reason, sizeof(reason), "*** mutexUnlock of mutex owned by another task! (cur:%d owner:%d)  %s:%u\n", thisTaskID, m->state.lockedTask, justFilename(m->state.filename), (unsigned)m->state.lineno);
         debugPanic(reason);
 #else
         debugPanic("*** mutexUnlock of mutex owned by another task!");
 #endif
     }
 #if mutexTrace && SHOW_MUTEX_DURATION_WARNINGS
-    int64_t xLockedMs = 0;
     const char *xFilename = m->state.filename;
     uint32_t xLineno = m->state.lineno;
-    xLockedMs = m->state.lockedMs;
+#endif
+#if MUTEX_TIMED
+    uint32_t heldUs = cpuRunTimeCounter() - m->state.lockedUs;
+#endif
+#if mutexContention
+    mutexStatReleased(m, heldUs);
 #endif
     m->state.lockedTask = -1;
-    m->state.lockedMs = 0;
 #if mutexTrace
-    taskMutexes[taskID()] &= ~m->mtx;
+    taskMutexes[thisTaskID] &= ~m->mtx;
 #endif
 
 #if mutexTrace
@@ -216,20 +410,16 @@ void mutexUnlock(mutex *m)
     xSemaphoreGive(m->state.handle);
 
 #if mutexTrace && SHOW_MUTEX_DURATION_WARNINGS
-    if (xLockedMs != 0) {
-        int64_t msElapsed = timerMs() - xLockedMs;
-        if (msElapsed > MUTEX_HELD_DURATION_WARNING_MS) {
-            if (m->mtx != MTX_EVENT) {      // Ignore simple waits for queue or timerMsSleep()
-                char *header = "=====\n";
-                char reason[128];
-                snprintf(reason, sizeof(reason), "===== mutexUnlock: locked for %dms %s:%u\n", (int) msElapsed, justFilename(xFilename), (unsigned)xLineno);
-                debugMessage(header);
-                debugMessage(header);
-                debugMessage(reason);
-                debugMessage(header);
-                debugMessage(header);
-            }
-        }
+    uint32_t msElapsed = heldUs / 1000;
+    if (msElapsed > MUTEX_HELD_DURATION_WARNING_MS && m->mtx != MTX_EVENT) {      // Ignore simple waits for queue or timerMsSleep()
+        char *header = "=====\n";
+        char reason[128];
+        snprintf(reason, sizeof(reason), "===== mutexUnlock: locked for %dms %s:%u\n", (int) msElapsed, justFilename(xFilename), (unsigned)xLineno);
+        debugMessage(header);
+        debugMessage(header);
+        debugMessage(reason);
+        debugMessage(header);
+        debugMessage(header);
     }
 #endif
 
@@ -10,6 +10,7 @@
 // This file was split out from global.h because its included headers are substantial and
 // thus by splitting it out there is a significant speedup of builds.
 #define mutexTrace              true        // Leave on in production because the cost is very low
+#define mutexContention         false       // Statistics for the "locks" command, which cost cycles on every lock
 
 // Mutex definitions, low-order to high-order in order of layering - for deadlock detection.
 // These values can be changed as necessary when adding new ones, however be very careful because
@@ -38,14 +39,19 @@ typedef struct {
     struct {
         volatile bool initialized;
         SemaphoreHandle_t handle;
+        StaticSemaphore_t buffer;
 #if mutexTrace
         const char *filename;
         uint32_t lineno;
 #endif
-        // Nonzero if locked, zero if locked
-        int64_t lockedMs;
         // For internal consistency validation
         int lockedTask;
+        // For contention statistics and duration warnings, when it was locked
+        uint32_t lockedUs;
+#if mutexContention
+        // Its type's contention statistics slot plus one
+        uint8_t statSlot;
+#endif
     } state;
 } mutex;
 #if mutexTrace
@@ -60,6 +66,23 @@ void mutexShow(mutex *m);
 void mutexInit(mutex *m, mtxtype_t mtype);
 void mutexDeInit(mutex *m);
 void mutexDebugOwned(const char **name, int64_t *owned);
+void mutexStats(void);
+void mutexStatsReset(void);
+void mutexBenchmark(void);
+
+// Tasks with statically allocated stacks
+bool taskCreate(int taskID, TaskFunction_t func, char *name, char letter, UBaseType_t priority, StackType_t *stack, uint32_t stackBytes);
+
+// Completions, on which drivers wait for I/O done by ISRs.  The waiting task blocks on a
+// notification given by the completion ISR, falling back to spinning where it can't block.
+typedef struct {
+    TaskHandle_t volatile waiter;
+} taskCompletion;
+typedef bool (*taskCompletionDoneFunc)(void *arg);
+bool taskCanBlock(void);
+bool taskCompletionWait(taskCompletion *c, taskCompletionDoneFunc done, void *arg, uint32_t timeoutMs);
+void taskCompletionSignalFromISR(taskCompletion *c);
+void taskDelayMs(uint32_t ms);
 
 // Events
 typedef struct {
@@ -89,5 +112,8 @@ void taskQueueFree(taskQueue *queue);
 bool taskQueuePut(taskQueue *queue, void *data, uint32_t waitMs);
 bool taskQueueGet(taskQueue *queue, void *data, uint32_t waitMs);
 
+// ring.c
+#include "ring.h"
+
 // App's overrides to defs in this file, which are resolved in the "weak" folder if the app doesn't define them
 #include "app_mutex.h"
@@ -0,0 +1,115 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "global.h"
+
+#if !defined(PROF_HOST)
+#include "main.h"
+#endif
+
+// Profiling sites register themselves here the first time they record.  Sites are static within
+// the functions that they measure, so the table only holds pointers to them.
+#define PROF_MAX_SITES      24
+STATIC profSite *profSites[PROF_MAX_SITES];
+STATIC uint32_t profSiteCount = 0;
+STATIC uint32_t profSiteOverflows = 0;
+
+// Enable the cycle counter.  On the device this is the DWT's CYCCNT, which counts core clocks
+// and wraps about once a minute at 80MHz, which is fine for timing anything shorter than that.
+void profInit(void)
+{
+#if !defined(PROF_HOST)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+// Get the current cycle count.  On a host build, nanoseconds from the monotonic clock stand in
+// for cycles.
+uint32_t profCycles(void)
+{
+#if defined(PROF_HOST)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec);
+#else
+    return DWT->CYCCNT;
+#endif
+}
+
+// Cycles per microsecond, for display
+STATIC uint32_t profCyclesPerUs(void)
+{
+#if defined(PROF_HOST)
+    return 1000;
+#else
+    return GMAX(SystemCoreClock / 1000000, 1);
+#endif
+}
+
+// Record the cycles elapsed since a site's scope began.  This may be called from an ISR, so the
+// update is done with interrupts masked rather than under a mutex.
+void profRecord(profSite *site, uint32_t beganCycles)
+{
+    uint32_t cycles = profCycles() - beganCycles;
+#if !defined(PROF_HOST)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+#endif
+    if (!site->registered) {
+        if (profSiteCount < PROF_MAX_SITES) {
+            profSites[profSiteCount++] = site;
+            site->registered = true;
+        } else {
+            profSiteOverflows++;
+        }
+    }
+    if (site->count == 0 || cycles < site->min) {
+        site->min = cycles;
+    }
+    if (cycles > site->max) {
+        site->max = cycles;
+    }
+    site->total += cycles;
+    site->count++;
+#if !defined(PROF_HOST)
+    __set_PRIMASK(primask);
+#endif
+}
+
+// Reset the statistics of all sites, leaving them registered
+void profReset(void)
+{
+#if !defined(PROF_HOST)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+#endif
+    for (uint32_t i=0; i<profSiteCount; i++) {
+        profSite *site = profSites[i];
+        site->count = site->min = site->max = 0;
+        site->total = 0;
+    }
+#if !defined(PROF_HOST)
+    __set_PRIMASK(primask);
+#endif
+}
+
+// Display the statistics of all sites that have recorded since boot
+void profStats(void)
+{
+    uint32_t perUs = profCyclesPerUs();
+    debugR("%-20s %8s %12s %8s %8s %8s %8s\n", "site", "count", "cycles", "min", "avg", "max", "avgUs");
+    for (uint32_t i=0; i<profSiteCount; i++) {
+        profSite site = *profSites[i];
+        uint32_t avg = (site.count == 0) ? 0 : (uint32_t) (site.total / site.count);
+        debugR("%-20s %8lu %12llu %8lu %8lu %8lu %8lu\n", site.name,
+               (unsigned long) site.count, (unsigned long long) site.total,
+               (unsigned long) site.min, (unsigned long) avg, (unsigned long) site.max,
+               (unsigned long) (avg / perUs));
+    }
+    if (profSiteOverflows != 0) {
+        debugR("%lu records from unregistered sites (increase PROF_MAX_SITES)\n", (unsigned long) profSiteOverflows);
+    }
+}
@@ -0,0 +1,223 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "global.h"
+#include "mutex.h"
+
+// Allocate a ring, rounding the number of entries up to a power of two.  Returns true if success.
+bool taskRingAlloc(uint32_t bytesPerEntry, uint32_t numEntries, bool multiProducer, taskRing **pRing)
+{
+    uint32_t entries = 1;
+    while (entries < numEntries) {
+        entries <<= 1;
+    }
+    taskRing *ring;
+    err_t err = memAlloc(sizeof(taskRing) + (entries * sizeof(atomic_uint)) + (entries * bytesPerEntry), &ring);
+    if (err) {
+        return false;
+    }
+    ring->mask = entries - 1;
+    ring->entryBytes = bytesPerEntry;
+    ring->multiProducer = multiProducer;
+    ring->seq = (atomic_uint *) (&ring[1]);
+    ring->data = (uint8_t *) (&ring->seq[entries]);
+    for (uint32_t i=0; i<entries; i++) {
+        atomic_init(&ring->seq[i], i);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    *pRing = ring;
+    return true;
+}
+
+// Free a ring, which must no longer be in use
+void taskRingFree(taskRing *ring)
+{
+    memFree(ring);
+}
+
+// See how many entries are pending
+uint32_t taskRingPending(taskRing *ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+// Claim a position and copy an entry into its slot, without blocking.  Returns false if full.
+STATIC bool taskRingTryPut(taskRing *ring, void *data)
+{
+    unsigned pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_uint *seq;
+    while (true) {
+        seq = &ring->seq[pos & ring->mask];
+        int diff = (int) (atomic_load_explicit(seq, memory_order_acquire) - pos);
+        if (diff < 0) {
+            return false;
+        }
+        if (diff > 0) {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        } else if (!ring->multiProducer) {
+            atomic_store_explicit(&ring->head, pos + 1, memory_order_relaxed);
+            break;
+        } else if (atomic_compare_exchange_weak(&ring->head, &pos, pos + 1)) {
+            break;
+        }
+    }
+    memcpy(&ring->data[(pos & ring->mask) * ring->entryBytes], data, ring->entryBytes);
+    atomic_store_explicit(seq, pos + 1, memory_order_release);
+    return true;
+}
+
+// Take the entry at the tail if its put has completed, without blocking.  Returns false if empty.
+STATIC bool taskRingTryGet(taskRing *ring, void *data)
+{
+    unsigned pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_uint *seq = &ring->seq[pos & ring->mask];
+    if (atomic_load_explicit(seq, memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    memcpy(data, &ring->data[(pos & ring->mask) * ring->entryBytes], ring->entryBytes);
+    atomic_store_explicit(seq, pos + ring->mask + 1, memory_order_release);
+    atomic_store_explicit(&ring->tail, pos + 1, memory_order_release);
+    return true;
+}
+
+// Whether the slot at the tail holds a completed put
+STATIC bool taskRingReadable(taskRing *ring)
+{
+    unsigned pos = atomic_load(&ring->tail);
+    return atomic_load(&ring->seq[pos & ring->mask]) == pos + 1;
+}
+
+// Whether the slot at the head is free
+STATIC bool taskRingWritable(taskRing *ring)
+{
+    unsigned pos = atomic_load(&ring->head);
+    return atomic_load(&ring->seq[pos & ring->mask]) == pos;
+}
+
+// Register as the waiter on a ring and wait for a notification, unless the ring became ready in
+// the meantime.  Waits are in slices of at most maxMs.  Only one producer at a time registers,
+// and any others just sleep for the slice and retry, so that a task that finds itself no longer
+// registered knows that it was notified.  The notification count is shared with taskTake(), so
+// any notification that turns out not to have been for the ring is counted in *others so that it
+// can be given back, and one that the ring gave after we stopped waiting for it is taken so that
+// it doesn't wake a later take.  Returns false on timeout.
+STATIC bool taskRingWait(taskRing *ring, TaskHandle_t volatile *waiter, bool (*ready)(taskRing *ring), int64_t expiresMs, uint32_t maxMs, uint32_t *others)
+{
+    int64_t now = timerMs();
+    if (now >= expiresMs) {
+        return false;
+    }
+    TickType_t ticks = (TickType_t) GMIN(expiresMs - now, maxMs);
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    taskENTER_CRITICAL();
+    bool registered = (*waiter == NULL);
+    if (registered) {
+        *waiter = self;
+    }
+    taskEXIT_CRITICAL();
+    if (!registered) {
+        vTaskDelay(ticks);
+        return true;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    bool notified = false;
+    if (!ready(ring)) {
+        notified = (ulTaskNotifyTake(pdFALSE, ticks) != 0);
+    }
+
+    // The ring clears the waiter when it notifies us, so see whether it did
+    taskENTER_CRITICAL();
+    bool signalled = (*waiter != self);
+    if (!signalled) {
+        *waiter = NULL;
+    }
+    taskEXIT_CRITICAL();
+    if (signalled && !notified) {
+        ulTaskNotifyTake(pdFALSE, 0);
+    } else if (notified && !signalled) {
+        (*others)++;
+    }
+    return true;
+}
+
+// Notify the waiter on a ring, if any, clearing it in the same critical section so that the
+// waiter never sees itself cleared before the notification has been given
+STATIC void taskRingNotify(TaskHandle_t volatile *waiter)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (*waiter == NULL) {
+        return;
+    }
+    taskENTER_CRITICAL();
+    TaskHandle_t task = *waiter;
+    if (task != NULL) {
+        *waiter = NULL;
+        xTaskNotifyGive(task);
+    }
+    taskEXIT_CRITICAL();
+}
+
+// Give back notifications consumed while waiting that weren't for the ring
+void taskRingGiveBack(uint32_t others)
+{
+    while (others-- > 0) {
+        xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+    }
+}
+
+// Put an entry into a ring, waiting up to waitMs for space.  Returns false on timeout.
+bool taskRingPut(taskRing *ring, void *data, uint32_t waitMs)
+{
+    int64_t expiresMs = timerMs() + waitMs;
+    uint32_t maxMs = ring->multiProducer ? TASK_RING_PRODUCER_POLL_MS : waitMs;
+    uint32_t others = 0;
+    bool success;
+    while (!(success = taskRingTryPut(ring, data))) {
+        if (!taskRingWait(ring, &ring->producer, taskRingWritable, expiresMs, maxMs, &others)) {
+            break;
+        }
+    }
+    taskRingGiveBack(others);
+    if (success) {
+        taskRingNotify(&ring->consumer);
+    }
+    return success;
+}
+
+// Put an entry into a ring from an ISR, never blocking.  Returns false if full.
+bool taskRingPutFromISR(taskRing *ring, void *data)
+{
+    if (!taskRingTryPut(ring, data)) {
+        return false;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    TaskHandle_t consumer = ring->consumer;
+    if (consumer != NULL) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        ring->consumer = NULL;
+        vTaskNotifyGiveFromISR(consumer, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+    return true;
+}
+
+// Get an entry from a ring, waiting up to waitMs for one.  Only one task may get from a ring.
+// Returns false on timeout.
+bool taskRingGet(taskRing *ring, void *data, uint32_t waitMs)
+{
+    int64_t expiresMs = timerMs() + waitMs;
+    uint32_t others = 0;
+    bool success;
+    while (!(success = taskRingTryGet(ring, data))) {
+        if (!taskRingWait(ring, &ring->consumer, taskRingReadable, expiresMs, waitMs, &others)) {
+            break;
+        }
+    }
+    taskRingGiveBack(others);
+    if (success) {
+        taskRingNotify(&ring->producer);
+    }
+    return success;
+}
@@ -0,0 +1,34 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+// This is included by mutex.h, after the FreeRTOS headers whose task handles it uses, and is
+// separate from it so that the rings can be built and tested on the host.
+
+#include <stdatomic.h>
+
+// Lock-free rings, for handing entries to a single consumer task from one producer or, if
+// multiProducer, from several tasks and ISRs.  Each slot carries a sequence number that says
+// whether it is free for the put of a given position or holds the entry for the get of it, so
+// producers only contend on claiming a position.  Blocking is done with task notifications.
+typedef struct {
+    uint32_t mask;                      // Entries minus one, entries being a power of two
+    uint32_t entryBytes;
+    bool multiProducer;
+    atomic_uint head;                   // Next position to put
+    atomic_uint tail;                   // Next position to get
+    TaskHandle_t volatile consumer;     // The consumer, while it waits for an entry
+    TaskHandle_t volatile producer;     // A producer, while it waits for a free slot
+    atomic_uint *seq;
+    uint8_t *data;
+} taskRing;
+#define TASK_RING_PRODUCER_POLL_MS  10      // Longest that a blocked producer waits between retries
+bool taskRingAlloc(uint32_t bytesPerEntry, uint32_t numEntries, bool multiProducer, taskRing **pRing);
+void taskRingFree(taskRing *ring);
+uint32_t taskRingPending(taskRing *ring);
+bool taskRingPut(taskRing *ring, void *data, uint32_t waitMs);
+bool taskRingPutFromISR(taskRing *ring, void *data);
+bool taskRingGet(taskRing *ring, void *data, uint32_t waitMs);
+void taskRingGiveBack(uint32_t others);
@@ -9,64 +9,110 @@
 // The mutex to protect event queues
 STATIC mutex queueMutex = {MTX_QUEUE, {0}};
 
-// Under FreeRTOS, the task contexts are task handles
-STATIC TaskHandle_t taskHandle[TASKID_NUM_TASKS] = {0};
-STATIC int64_t takeTimeoutDueMs[TASKID_NUM_TASKS] = {0};
-STATIC char *taskName[TASKID_NUM_TASKS] = {0};
-STATIC char taskLetter[TASKID_NUM_TASKS] = {0};
-STATIC uint32_t taskStackBytes[TASKID_NUM_TASKS] = {0};
-STATIC bool taskNoBlock[TASKID_NUM_TASKS] = {0};
-
+// The registry of tasks, indexed by task ID.  Tasks created with taskCreate() have their TCBs
+// here and their stacks statically allocated by the app, so that they don't come from the heap.
+typedef struct {
+    TaskHandle_t handle;
+    char *name;
+    char letter;
+    uint32_t stackBytes;
+    bool noBlock;
+    int64_t takeTimeoutDueMs;
+    uint32_t subscribed;
+    atomic_uint events;
+    StaticTask_t tcb;
+} taskInfo;
+STATIC taskInfo taskTable[TASKID_NUM_TASKS] = {0};
+
+// The IDs of registered tasks in the order registered, so that scans skip unused IDs.  Entries
+// are only ever appended, and the count is bumped after the entry is written, so ISRs may scan.
+STATIC int taskRegistered[TASKID_NUM_TASKS];
+STATIC volatile uint32_t taskRegisteredCount = 0;
+
+// Timeouts taken with slack, and how many of those were moved to wake with another task
+STATIC uint32_t taskSlackTimeouts = 0;
+STATIC uint32_t taskCoalescedTimeouts = 0;
 
 // Set a task as doing its own blocking as opposed to using taskTake for blocks
 void taskRegisterAsNonBlocking(int taskID)
 {
-    taskNoBlock[taskID] = true;
+    taskTable[taskID].noBlock = true;
+}
+
+// Add a task to the registry, tagging it with its ID in its thread local storage
+STATIC void taskAdd(int taskID, TaskHandle_t handle, char *name, char letter, uint32_t stackBytes)
+{
+    if (taskID < 0 || taskID >= TASKID_NUM_TASKS) {
+        debugPanic("task ID out of range");
+        return;
+    }
+    taskInfo *t = &taskTable[taskID];
+    t->name = name;
+    t->letter = letter;
+    t->stackBytes = stackBytes;
+    vTaskSetThreadLocalStoragePointer(handle, TASK_TLS_INDEX, (void *) (uintptr_t) (taskID + 1));
+    taskENTER_CRITICAL();
+    if (t->handle == NULL) {
+        taskRegistered[taskRegisteredCount] = taskID;
+        __DMB();
+        taskRegisteredCount++;
+    }
+    t->handle = handle;
+    taskEXIT_CRITICAL();
 }
 
-// Register a task's context
+// Register the current task's context, for tasks that weren't created by taskCreate()
 void taskRegister(int taskID, char *name, char letter, uint32_t stackBytes)
 {
-    taskHandle[taskID] = xTaskGetCurrentTaskHandle();
-    taskName[taskID] = name;
-    taskLetter[taskID] = letter;
-    taskStackBytes[taskID] = stackBytes;
+    taskAdd(taskID, xTaskGetCurrentTaskHandle(), name, letter, stackBytes);
+}
+
+// Create and register a task whose stack is statically allocated by the caller, which may be done
+// before the scheduler is started.  Returns false if the task couldn't be created.
+bool taskCreate(int taskID, TaskFunction_t func, char *name, char letter, UBaseType_t priority, StackType_t *stack, uint32_t stackBytes)
+{
+    if (taskID < 0 || taskID >= TASKID_NUM_TASKS || taskTable[taskID].handle != NULL) {
+        debugPanic("task ID out of range or in use");
+        return false;
+    }
+    TaskHandle_t handle = xTaskCreateStatic(func, name, STACKWORDS(stackBytes), NULL, priority, stack, &taskTable[taskID].tcb);
+    if (handle == NULL) {
+        return false;
+    }
+    taskAdd(taskID, handle, name, letter, stackBytes);
+    return true;
 }
 
 // Get a task's name
 char *taskLabel(int taskID)
 {
-    char *label = taskName[taskID];
+    char *label = taskTable[taskID].name;
     return label == NULL ? "" : label;
 }
 
+// Get the current task's ID plus one from its thread local storage, or 0 if it isn't registered
+STATIC int taskTLS(void)
+{
+    return (int) (uintptr_t) pvTaskGetThreadLocalStoragePointer(NULL, TASK_TLS_INDEX);
+}
+
 // Get a task's identifying character
 char taskIdentifier(void)
 {
-    char taskChar = '?';
-    TaskHandle_t currentTaskHandle = xTaskGetCurrentTaskHandle();
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        if (taskHandle[task] == currentTaskHandle) {
-            taskChar = taskLetter[task];
-            break;
-        }
-    }
-    return taskChar;
+    int tls = taskTLS();
+    return tls == 0 ? '?' : taskTable[tls-1].letter;
 }
 
 // Get a task's ID.
 int taskID(void)
 {
-    int id = 0;
-    TaskHandle_t currentTaskHandle = xTaskGetCurrentTaskHandle();
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        if (taskHandle[task] == currentTaskHandle) {
-            return task;
-        }
+    int tls = taskTLS();
+    if (tls == 0) {
+        // Defensive programming only.
+        debugPanic("task not found");
+        return 0;
     }
-    // Defensive programming only.
-    debugPanic("task not found");
-    return id;
+    return tls-1;
 }
 
 // Return the shortest number of milliseconds that it's safe to sleep, in absence of an interrupt,
@@ -79,19 +125,30 @@ uint32_t taskAllIdleForMs(bool trace)
     bool somethingRunning = false;
     char buf[32], status[256];
     if (trace) {
-        snprintf(status, sizeof(status), "%c:run", taskLetter[myTaskID]);
+        snprintf(status, sizeof(status), "%c:run", taskTable[myTaskID].letter);
+    }
+
+    // Copy the deadlines out in one critical section, because they can't be read in one access
+    int64_t taskDueMsCopy[TASKID_NUM_TASKS];
+    taskENTER_CRITICAL();
+    uint32_t registered = taskRegisteredCount;
+    for (uint32_t r=0; r<registered; r++) {
+        taskDueMsCopy[r] = taskTable[taskRegistered[r]].takeTimeoutDueMs;
     }
-    for (int i=0; i<TASKID_NUM_TASKS; i++) {
-        // Skip tasks that aren't initialized, and skip our task because obviously we're running
-        if (taskNoBlock[i] || taskName[i] == NULL || i == myTaskID) {
+    taskEXIT_CRITICAL();
+
+    for (uint32_t r=0; r<registered; r++) {
+        // Skip tasks that do their own blocking, and skip our task because obviously we're running
+        int i = taskRegistered[r];
+        if (taskTable[i].noBlock || i == myTaskID) {
             continue;
         }
         // If we find something running or which is already due, we're done
-        int64_t taskDueMs = takeTimeoutDueMs[i];
+        int64_t taskDueMs = taskDueMsCopy[r];
         if (taskDueMs == 0) {
             somethingRunning = true;
             if (trace) {
-                snprintf(buf, sizeof(buf), " %c:run", taskLetter[i]);
+                snprintf(buf, sizeof(buf), " %c:run", taskTable[i].letter);
                 strLcat(status, buf);
             } else {
                 break;
@@ -99,7 +156,7 @@ uint32_t taskAllIdleForMs(bool trace)
         } else if (taskDueMs < nowMs) {
             somethingRunning = true;
             if (trace) {
-                snprintf(buf, sizeof(buf), " %c:due", taskLetter[i]);
+                snprintf(buf, sizeof(buf), " %c:due", taskTable[i].letter);
                 strLcat(status, buf);
             } else {
                 break;
@@ -111,9 +168,9 @@ uint32_t taskAllIdleForMs(bool trace)
             if (trace) {
                 uint32_t ms = (uint32_t) (taskDueMs - nowMs);
                 if (ms > ms1Sec) {
-                    snprintf(buf, sizeof(buf), " %c:%lds", taskLetter[i], (long) (ms/ms1Sec));
+                    snprintf(buf, sizeof(buf), " %c:%lds", taskTable[i].letter, (long) (ms/ms1Sec));
                 } else {
-                    snprintf(buf, sizeof(buf), " %c:%ldms", taskLetter[i], (long) ms);
+                    snprintf(buf, sizeof(buf), " %c:%ldms", taskTable[i].letter, (long) ms);
                 }
                 strLcat(status, buf);
             }
@@ -129,9 +186,57 @@ uint32_t taskAllIdleForMs(bool trace)
     return dueMs;
 }
 
+// Set when a task is due to wake, which other tasks read to choose when to wake themselves.  The
+// deadline is 64 bits, which this core can't store in one access, so it is set and read in
+// critical sections so that a task preempted halfway through never leaves half of one.
+STATIC void taskSetDueMs(int taskID, int64_t dueMs)
+{
+    taskENTER_CRITICAL();
+    taskTable[taskID].takeTimeoutDueMs = dueMs;
+    taskEXIT_CRITICAL();
+}
+
+// Choose when to wake for a timeout that may fire anywhere from earliestMs to slackMs later.  If
+// another task is already due to wake within that window we wake with it, and otherwise at the
+// latest point in the window that lies on a power-of-two grid no coarser than the slack, so that
+// other timeouts with slack tend to choose the same point.  Either way the MCU wakes once rather
+// than for each task.
+STATIC int64_t taskSlackDueMs(int64_t earliestMs, uint32_t slackMs)
+{
+    int64_t latestMs = earliestMs + slackMs;
+    int64_t dueMs = 0;
+    taskENTER_CRITICAL();
+    for (uint32_t r=0; r<taskRegisteredCount; r++) {
+        int64_t taskDueMs = taskTable[taskRegistered[r]].takeTimeoutDueMs;
+        if (taskDueMs >= earliestMs && taskDueMs <= latestMs && (dueMs == 0 || taskDueMs < dueMs)) {
+            dueMs = taskDueMs;
+        }
+    }
+    taskSlackTimeouts++;
+    if (dueMs != 0) {
+        taskCoalescedTimeouts++;
+    }
+    taskEXIT_CRITICAL();
+    if (dueMs != 0) {
+        return dueMs;
+    }
+    int64_t gridMs = 1;
+    while (gridMs * 2 <= slackMs) {
+        gridMs *= 2;
+    }
+    return latestMs - (latestMs % gridMs);
+}
+
 // Take from the task's event semaphore.  This should be a counting semaphore so that we avoid any
 // race conditions between a take wakeup and the next take.  Return false if timeout.
 bool taskTake(int taskID, uint32_t timeoutMs)
+{
+    return taskTakeSlack(taskID, timeoutMs, 0);
+}
+
+// Take from the task's event semaphore, allowing the timeout to be extended by up to slackMs so
+// that the task can wake together with others.  Return false if timeout.
+bool taskTakeSlack(int taskID, uint32_t timeoutMs, uint32_t slackMs)
 {
 
     // Don't rely upon RTOS semantics, where sometimes 0 means "infinite"
@@ -145,15 +250,23 @@ bool taskTake(int taskID, uint32_t timeoutMs)
     }
 
     // Defensive coding for init
-    if (taskHandle[taskID] == 0) {
+    if (taskTable[taskID].handle == NULL) {
         return true;
     }
 
+    // Align the timeout with those of other tasks if we were given slack
+    int64_t nowMs = timerMs();
+    int64_t dueMs = nowMs + (int64_t) timeoutMs;
+    if (slackMs != 0 && timeoutMs != portMAX_DELAY) {
+        dueMs = taskSlackDueMs(dueMs, slackMs);
+        timeoutMs = (uint32_t) (dueMs - nowMs);
+    }
+
     // Pause
     tssPreSuspend(taskID);
-    takeTimeoutDueMs[taskID] = timerMs() + (int64_t) timeoutMs;
+    taskSetDueMs(taskID, dueMs);
     bool timeout = (ulTaskNotifyTake(pdFALSE, timeoutMs) == 0);
-    takeTimeoutDueMs[taskID] = 0;
+    taskSetDueMs(taskID, 0);
     tssPostSuspend(taskID);
 
     // Done
@@ -163,31 +276,113 @@ bool taskTake(int taskID, uint32_t timeoutMs)
 // Give to an event's semaphore, but not from an ISR
 void taskGive(int taskID)
 {
-    if (taskHandle[taskID] == 0) {
-        return;
-    }
-    TaskHandle_t hTask = taskHandle[taskID];
-    if (hTask != xTaskGetCurrentTaskHandle()) {
+    TaskHandle_t hTask = taskTable[taskID].handle;
+    if (hTask != NULL && hTask != xTaskGetCurrentTaskHandle()) {
         xTaskNotifyGive(hTask);
     }
 }
 
-// Give to all tasks from an ISR
+// Give to all registered tasks from an ISR
 void taskGiveAllFromISR(void)
 {
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        taskGiveFromISR(task);
+    for (uint32_t r=0; r<taskRegisteredCount; r++) {
+        taskGiveFromISR(taskRegistered[r]);
+    }
+}
+
+// Subscribe a task to events, so that it is woken when any of them are signalled
+void taskSubscribe(int taskID, uint32_t events)
+{
+    taskENTER_CRITICAL();
+    taskTable[taskID].subscribed |= events;
+    taskEXIT_CRITICAL();
+}
+
+// Fire events, adding them to the pending events of each registered task that is subscribed to
+// any of them and waking it
+STATIC void taskSignalEvents(uint32_t events, bool fromISR)
+{
+    for (uint32_t r=0; r<taskRegisteredCount; r++) {
+        int task = taskRegistered[r];
+        uint32_t fired = taskTable[task].subscribed & events;
+        if (fired != 0) {
+            atomic_fetch_or(&taskTable[task].events, fired);
+            if (fromISR) {
+                taskGiveFromISR(task);
+            } else {
+                taskGive(task);
+            }
+        }
+    }
+}
+
+// Signal events to the tasks subscribed to them, but not from an ISR
+void taskSignal(uint32_t events)
+{
+    taskSignalEvents(events, false);
+}
+
+// Signal events to the tasks subscribed to them from an ISR
+void taskSignalFromISR(uint32_t events)
+{
+    taskSignalEvents(events, true);
+}
+
+// Wait for events, returning those that fired, or 0 on timeout or if woken by a plain give.
+// Events already pending are returned without waiting.  The timeout may be extended by slackMs.
+// Each signal also gives, so once events are taken the gives of signals merged into them, and of
+// any that were pending, are cleared so that they don't cause spurious wakeups.  The caller must
+// then do whatever work a plain give might also have been for.  Events signalled after they were
+// taken stay pending, and so are returned by the next call without waiting.
+uint32_t taskTakeEvents(int taskID, uint32_t timeoutMs, uint32_t slackMs)
+{
+    uint32_t events = atomic_exchange(&taskTable[taskID].events, 0);
+    if (events == 0) {
+        taskTakeSlack(taskID, timeoutMs, slackMs);
+        events = atomic_exchange(&taskTable[taskID].events, 0);
     }
+    if (events != 0) {
+        ulTaskNotifyTake(pdTRUE, 0);
+    }
+    return events;
 }
 
 // Give to an event's semaphore from an ISR, and allow the scheduler to naturally determine what
 // task is next to be scheduled given task priorities as they are.
 void taskGiveFromISR(int taskID)
 {
-    if (taskHandle[taskID] == 0) {
-        return;
+    TaskHandle_t hTask = taskTable[taskID].handle;
+    if (hTask != NULL) {
+        vTaskNotifyGiveFromISR(hTask, NULL);
+    }
+}
+
+// Sleep the current task for at least ms and at most slackMs longer, waking with another task if
+// one is due within that window.  While asleep the task is shown by taskAllIdleForMs() as due
+// rather than as running.
+void taskSleep(uint32_t ms, uint32_t slackMs)
+{
+    int tls = taskTLS();
+    int64_t nowMs = timerMs();
+    int64_t dueMs = nowMs + (int64_t) ms;
+    if (slackMs != 0) {
+        dueMs = taskSlackDueMs(dueMs, slackMs);
+    }
+    if (tls != 0) {
+        taskSetDueMs(tls-1, dueMs);
+    }
+    vTaskDelay((uint32_t) (dueMs - nowMs));
+    if (tls != 0) {
+        taskSetDueMs(tls-1, 0);
     }
-    vTaskNotifyGiveFromISR(taskHandle[taskID], NULL);
+}
+
+// Display how often timeouts with slack were coalesced with those of other tasks
+void taskWakeupStats(void)
+{
+    debugR("timeouts with slack: %lu, coalesced with another task: %lu\n",
+           (unsigned long) taskSlackTimeouts, (unsigned long) taskCoalescedTimeouts);
+    taskAllIdleForMs(true);
 }
 
 // Terminate all task scheduling
@@ -208,13 +403,13 @@ void taskStackStats()
 
     debugR("task stacks:\n");
 
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        TaskHandle_t hTask = taskHandle[task];
-        if (hTask != 0) {
+    for (uint32_t r=0; r<taskRegisteredCount; r++) {
+        taskInfo *t = &taskTable[taskRegistered[r]];
+        if (t->handle != NULL) {
             TaskStatus_t status;
-            vTaskGetInfo(hTask, &status, pdTRUE, eInvalid);
-            double pct = (double)(status.usStackHighWaterMark*sizeof(StackType_t))/(double)taskStackBytes[task];
-            debugR("  %12s: %lu/%lu %0.2f%% remaining\n", status.pcTaskName, status.usStackHighWaterMark*sizeof(StackType_t), taskStackBytes[task], pct*100.0);
+            vTaskGetInfo(t->handle, &status, pdTRUE, eInvalid);
+            double pct = (double)(status.usStackHighWaterMark*sizeof(StackType_t))/(double)t->stackBytes;
+            debugR("  %12s: %lu/%lu %0.2f%% remaining\n", status.pcTaskName, status.usStackHighWaterMark*sizeof(StackType_t), t->stackBytes, pct*100.0);
             if (status.usStackHighWaterMark < STACKWORDS(500)) {
                 for (int i=0; i<8; i++) {
                     debugf("*****************************************************\n");
@@ -249,9 +444,9 @@ void taskIOPriorityEnd(uint32_t prio)
 void taskStackOverflowCheck()
 {
 
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        TaskHandle_t hTask = taskHandle[task];
-        if (hTask != 0) {
+    for (uint32_t r=0; r<taskRegisteredCount; r++) {
+        TaskHandle_t hTask = taskTable[taskRegistered[r]].handle;
+        if (hTask != NULL) {
             TaskStatus_t status;
             vTaskGetInfo(hTask, &status, pdTRUE, eInvalid);
             if (status.usStackHighWaterMark < 175) {
@@ -445,3 +640,110 @@ bool taskQueuePut(taskQueue *queue, void *data, uint32_t waitMs)
     return false;
 
 }
+
+// See whether the current context may block: the scheduler must be running, and we mustn't be in
+// an ISR or have interrupts masked
+bool taskCanBlock(void)
+{
+    return (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING && __get_IPSR() == 0
+            && __get_PRIMASK() == 0 && __get_BASEPRI() == 0);
+}
+
+// Spin until done or the timeout expires, as drivers did before completions could block.  The
+// timeout is kept with timerUs() rather than the tick, because we may be spinning with interrupts
+// masked, in which case the tick doesn't advance.  Nor can the ISR that would complete the I/O
+// run, so done() must then poll the hardware itself, or the wait can only time out.  The time
+// spent here is what the "waitSpun" profiling site reports.
+STATIC bool taskCompletionSpin(taskCompletionDoneFunc done, void *arg, uint32_t timeoutMs)
+{
+    PROF_BEGIN(waitSpun);
+    bool success = true;
+    int64_t expiresUs = timerUs() + ((int64_t) timeoutMs * 1000);
+    while (!done(arg)) {
+        if (timeoutMs != TASK_WAIT_FOREVER && timerUs() >= expiresUs) {
+            success = false;
+            break;
+        }
+    }
+    PROF_END(waitSpun);
+    return success;
+}
+
+// Block until done or the timeout expires.  The time spent here, reported by the "waitBlocked"
+// profiling site, is spinning that has been eliminated.  The notification count is shared with
+// taskTake(), so notifications that weren't from the completion are given back, and one that the
+// completion gave after we stopped waiting for it is taken so that it doesn't wake a later take.
+STATIC bool taskCompletionBlock(taskCompletion *c, taskCompletionDoneFunc done, void *arg, uint32_t timeoutMs)
+{
+    PROF_BEGIN(waitBlocked);
+    int64_t expiresMs = timerMs() + timeoutMs;
+    uint32_t others = 0;
+    bool success = true;
+    while (!done(arg)) {
+        int64_t nowMs = timerMs();
+        if (timeoutMs != TASK_WAIT_FOREVER && nowMs >= expiresMs) {
+            success = false;
+            break;
+        }
+        c->waiter = xTaskGetCurrentTaskHandle();
+        atomic_thread_fence(memory_order_seq_cst);
+        bool notified = false;
+        if (!done(arg)) {
+            TickType_t ticks = (timeoutMs == TASK_WAIT_FOREVER) ? portMAX_DELAY : (TickType_t) (expiresMs - nowMs);
+            notified = (ulTaskNotifyTake(pdFALSE, ticks) != 0);
+        }
+
+        // The completion clears the waiter when it notifies us, so see whether it did
+        taskENTER_CRITICAL();
+        bool signalled = (c->waiter == NULL);
+        c->waiter = NULL;
+        taskEXIT_CRITICAL();
+        if (signalled && !notified) {
+            ulTaskNotifyTake(pdFALSE, 0);
+        } else if (notified && !signalled) {
+            others++;
+        }
+    }
+    taskRingGiveBack(others);
+    PROF_END(waitBlocked);
+    return success;
+}
+
+// Wait until done(arg) returns true, or for up to timeoutMs (which may be TASK_WAIT_FOREVER).
+// The ISR that completes the I/O must call taskCompletionSignalFromISR() after making done()
+// true.  Where the caller can't block, which includes having interrupts masked, this spins, and
+// with interrupts masked only a done() that polls the hardware can succeed.  Returns false on
+// timeout.
+bool taskCompletionWait(taskCompletion *c, taskCompletionDoneFunc done, void *arg, uint32_t timeoutMs)
+{
+    if (done(arg)) {
+        return true;
+    }
+    if (!taskCanBlock()) {
+        return taskCompletionSpin(done, arg, timeoutMs);
+    }
+    return taskCompletionBlock(c, done, arg, timeoutMs);
+}
+
+// Wake the task waiting on a completion, if any, switching to it on return from the ISR
+void taskCompletionSignalFromISR(taskCompletion *c)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    TaskHandle_t task = c->waiter;
+    if (task != NULL) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        c->waiter = NULL;
+        vTaskNotifyGiveFromISR(task, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+}
+
+// Delay in a driver, blocking if possible and otherwise spinning
+void taskDelayMs(uint32_t ms)
+{
+    if (taskCanBlock()) {
+        vTaskDelay(ms);
+    } else {
+        HAL_Delay(ms);
+    }
+}
@@ -12,6 +12,17 @@
 // Boot time
 STATIC int64_t bootTimeMs = 0;
 
+// The cycle counter extended to 64 bits, and the time that it has been running in microseconds.
+// Each stretch of cycles between reads is converted at the clock that was running during it,
+// which is the clock at the start of the stretch, so a clock change never rescales past time.
+#if !defined(PROF_HOST)
+STATIC uint64_t timerRunCycles = 0;
+STATIC uint32_t timerLastCycles = 0;
+STATIC uint64_t timerRunUs = 0;
+STATIC uint32_t timerLeftoverCycles = 0;
+STATIC uint32_t timerRunCyclesPerUs = 0;
+#endif
+
 // Protect clib
 STATIC mutex timeMutex = {MTX_TIME, {0}};
 
@@ -57,6 +68,88 @@ int64_t timerMsFromISR(void)
     return MX_GetTickMsFromISR();
 }
 
+#if !defined(PROF_HOST)
+// Bring the extended cycle counter and the run time up to date, with interrupts masked.  It must
+// be called at least once per wrap of the cycle counter, about once a minute at 80MHz, which the
+// tick ISR does, and before the core clock is changed, which SystemClock_Config() does.
+STATIC void timerAdvance(uint64_t *runCycles, uint64_t *runUs)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now = profCycles();
+    uint32_t cycles = now - timerLastCycles;
+    timerLastCycles = now;
+    timerRunCycles += cycles;
+    uint32_t perUs = (timerRunCyclesPerUs == 0) ? timerCyclesPerUs() : timerRunCyclesPerUs;
+    uint32_t leftover = (cycles % perUs) + timerLeftoverCycles;
+    timerRunUs += (cycles / perUs) + (leftover / perUs);
+    timerLeftoverCycles = leftover % perUs;
+    timerRunCyclesPerUs = timerCyclesPerUs();
+    *runCycles = timerRunCycles;
+    *runUs = timerRunUs;
+    __set_PRIMASK(primask);
+}
+#endif
+
+// Get the number of core clock cycles executed since boot, for timing short intervals with
+// timerCyclesToUs() and timerCyclesToNs().  The cycle counter doesn't run in STOP2, and those
+// conversions use the current clock, so intervals that may span STOP2 or a clock change should
+// be timed with timerUs() instead.  This may be called from an ISR.
+uint64_t timerCycles(void)
+{
+#if defined(PROF_HOST)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#else
+    uint64_t runCycles, runUs;
+    timerAdvance(&runCycles, &runUs);
+    return runCycles;
+#endif
+}
+
+// Get the number of microseconds since boot, continuing across STOP2 and clock changes.  Time
+// spent stopped, as stepped into the tick by MX_StepTickMs(), is added to the time that the
+// cycle counter has been running.  This may be called from an ISR.
+int64_t timerUs(void)
+{
+#if defined(PROF_HOST)
+    return timerCyclesToUs(timerCycles());
+#else
+    uint64_t runCycles, runUs;
+    timerAdvance(&runCycles, &runUs);
+    return (int64_t) runUs + (MX_SteppedTickMs() * 1000);
+#endif
+}
+
+// Get the number of cycles per microsecond.  On a host build, timerCycles() counts nanoseconds.
+uint32_t timerCyclesPerUs(void)
+{
+#if defined(PROF_HOST)
+    return 1000;
+#else
+    return GMAX(SystemCoreClock / 1000000, 1);
+#endif
+}
+
+// Convert cycles to microseconds
+int64_t timerCyclesToUs(uint64_t cycles)
+{
+    return (int64_t) (cycles / timerCyclesPerUs());
+}
+
+// Convert cycles to nanoseconds
+int64_t timerCyclesToNs(uint64_t cycles)
+{
+    return (int64_t) ((cycles * 1000) / timerCyclesPerUs());
+}
+
+// Convert microseconds to cycles
+uint64_t timerUsToCycles(int64_t us)
+{
+    return (us <= 0) ? 0 : (uint64_t) us * timerCyclesPerUs();
+}
+
 // Delay for the specified number of milliseconds in a compute loop, without yielding.
 // This is primarily used for operations that could potentially
 // be executed in STOP2 mode, during which our task timers are not accurate.
@@ -72,6 +165,13 @@ void timerMsSleep(uint32_t ms)
     vTaskDelay(ms);
 }
 
+// Sleep for at least ms, allowing the wakeup to be up to slackMs later so that it can coincide
+// with that of another task
+void timerMsSleepSlack(uint32_t ms, uint32_t slackMs)
+{
+    taskSleep(ms, slackMs);
+}
+
 // See if the specified number of milliseconds has elapsed
 bool timerMsElapsed(int64_t began, uint32_t ms)
 {
@@ -127,7 +227,7 @@ bool timeSet(uint32_t newTimeSecs)
 #endif
     if (t == NULL) {
         mutexUnlock(&timeMutex);    // cannot do debugf with locked
-        debugf("time-set: error getting struct tm\n");
+        debugError(DEBUG_TIMER, "time-set: error getting struct tm\n");
         return false;
     }
     int year = t->tm_year+1900;
@@ -138,11 +238,11 @@ bool timeSet(uint32_t newTimeSecs)
     int sec0 = t->tm_sec;
     if (!MX_RTC_SetDateTime(year, mon1, day1, hour0, min0, sec0)) {
         mutexUnlock(&timeMutex);
-        debugf("time-set: HAL error setting date/time\n");
+        debugError(DEBUG_TIMER, "time-set: HAL error setting date/time\n");
         return false;
     }
     mutexUnlock(&timeMutex);
-    debugf("time-set: %d %04d-%02d-%02dT%02d:%02d:%02dZ\n", newTimeSecs, year, mon1, day1, hour0, min0, sec0);
+    debugInfo(DEBUG_TIMER, "time-set: %d %04d-%02d-%02dT%02d:%02d:%02dZ\n", newTimeSecs, year, mon1, day1, hour0, min0, sec0);
     return true;
 }
 
@@ -0,0 +1,119 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks the array growth policy and arrayReserve: how many times a 10KB byte array is
+// reallocated under the default and chunk-only policies, that a presized array is allocated
+// exactly once, that reserving in an arena spills to the heap with its contents intact, and
+// that single appends longer than 64KB are accepted.
+
+#include "bench.h"
+
+#define BUILD_BYTES     10240
+
+// Build a byte array a line at a time, returning how many times its buffer was reallocated
+static uint32_t arrayBuild(array *ctx, uint32_t bytes, uint32_t *maxStep)
+{
+    static const char line[] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde\n";
+    uint32_t reallocations = 0;
+    uint32_t allocated = arrayCapacity(ctx);
+    *maxStep = 0;
+    while (arrayLength(ctx) < bytes) {
+        CHECK(arrayAppendBytes(ctx, (void *) line, sizeof(line)-1) == errNone);
+        if (arrayCapacity(ctx) != allocated) {
+            if (allocated != 0) {
+                *maxStep = GMAX(*maxStep, arrayCapacity(ctx) - allocated);
+            }
+            allocated = arrayCapacity(ctx);
+            reallocations++;
+        }
+    }
+    for (uint32_t i=0; i<arrayLength(ctx); i++) {
+        CHECK(((char *) arrayAddress(ctx))[i] == line[i % (sizeof(line)-1)]);
+    }
+    return reallocations;
+}
+
+int main(void)
+{
+    array *ctx;
+    uint32_t maxStep;
+
+    // The default policy grows geometrically, capped at 4KB per step
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    uint32_t defaultGrowths = arrayBuild(ctx, BUILD_BYTES, &maxStep);
+    CHECK(maxStep <= 4096);
+    arrayFree(ctx);
+
+    // Growing by the chunk size alone takes about twice as many reallocations
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    arrayGrowth(ctx, 512, 1, 512);
+    uint32_t chunkGrowths = arrayBuild(ctx, BUILD_BYTES, &maxStep);
+    CHECK(maxStep == 512);
+    CHECK(defaultGrowths * 2 <= chunkGrowths);
+    arrayFree(ctx);
+
+    // A lower cap bounds each step, and a larger chunk size sets its minimum
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    arrayGrowth(ctx, 0, 100, 1024);
+    arrayBuild(ctx, BUILD_BYTES, &maxStep);
+    CHECK(maxStep == 1024);
+    arrayFree(ctx);
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    arrayGrowth(ctx, 2048, 0, 0);
+    CHECK(arrayBuild(ctx, BUILD_BYTES, &maxStep) <= 5);
+    CHECK(maxStep >= 2048);
+    arrayFree(ctx);
+
+    // A presized array is allocated exactly once, and reserving less than it has is a no-op
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    CHECK(arrayReserve(ctx, 0) == errNone);
+    CHECK(arrayAddress(ctx) == NULL);
+    CHECK(arrayReserve(ctx, BUILD_BYTES) == errNone);
+    void *address = arrayAddress(ctx);
+    CHECK(address != NULL && arrayCapacity(ctx) == BUILD_BYTES);
+    CHECK(arrayBuild(ctx, BUILD_BYTES, &maxStep) == 0);
+    CHECK(arrayAddress(ctx) == address);
+    CHECK(arrayReserve(ctx, 100) == errNone);
+    CHECK(arrayAddress(ctx) == address && arrayCapacity(ctx) == BUILD_BYTES);
+
+    // Reserving more keeps what was already built
+    CHECK(arrayReserve(ctx, BUILD_BYTES*2) == errNone);
+    CHECK(arrayCapacity(ctx) == BUILD_BYTES*2);
+    CHECK(arrayBuild(ctx, BUILD_BYTES*2, &maxStep) == 0);
+    arrayFree(ctx);
+
+    // Reserving within an arena takes from the arena, and beyond it moves the buffer to the heap
+    memArena arena;
+    CHECK(memArenaInit(&arena, 4096) == errNone);
+    CHECK(arrayAllocArena(&arena, 0, NULL, &ctx) == errNone);
+    CHECK(arrayReserve(ctx, 1024) == errNone);
+    CHECK(memArenaOwns(&arena, arrayAddress(ctx)));
+    CHECK(arrayBuild(ctx, 1024, &maxStep) == 0);
+    CHECK(arrayReserve(ctx, BUILD_BYTES) == errNone);
+    CHECK(!memArenaOwns(&arena, arrayAddress(ctx)));
+    CHECK(arrayBuild(ctx, BUILD_BYTES, &maxStep) == 0);
+    arrayFree(ctx);
+    memArenaReset(&arena);
+    memFree(arena.base);
+
+    // Byte appends aren't limited to 16-bit lengths
+    uint32_t bigLen = 70000;
+    uint8_t *big = malloc(bigLen);
+    CHECK(big != NULL);
+    for (uint32_t i=0; i<bigLen; i++) {
+        big[i] = (uint8_t) (i * 7);
+    }
+    CHECK(arrayAllocBytes(&ctx) == errNone);
+    CHECK(arrayAppendBytes(ctx, big, bigLen) == errNone);
+    CHECK(arrayAppendBytes(ctx, big, 1) == errNone);
+    CHECK(arrayLength(ctx) == bigLen+1);
+    CHECK(memcmp(arrayAddress(ctx), big, bigLen) == 0);
+    arrayFree(ctx);
+    free(big);
+
+    printf("10KB built with %lu reallocations by default, %lu growing by chunks\n",
+           (unsigned long) defaultGrowths, (unsigned long) chunkGrowths);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks the constant-time civilDaysFromDate, which the RTC uses on every entry to and exit from
+// STOP2, against the year-by-year loop of rk_timegm for every day from 1970 through 2199, and
+// benchmarks the two for a current date.
+
+#include <time.h>
+#include "bench.h"
+
+#define BENCH_CALLS     1000000
+
+time_t rk_timegm(struct tm *tm);
+
+// Days in each month
+static int civilMonthDays(int year, int mon1)
+{
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4) == 0 && ((year % 100) != 0 || (year % 400) == 0);
+    return (mon1 == 2 && leap) ? 29 : days[mon1-1];
+}
+
+int main(void)
+{
+
+    // Every day, which must also be one more than the day before
+    int64_t expected = 0;
+    for (int year=1970; year<2200; year++) {
+        for (int mon1=1; mon1<=12; mon1++) {
+            for (int day1=1; day1<=civilMonthDays(year, mon1); day1++) {
+                struct tm tm = {0};
+                tm.tm_year = year - 1900;
+                tm.tm_mon = mon1 - 1;
+                tm.tm_mday = day1;
+                int64_t days = civilDaysFromDate(year, mon1, day1);
+                if (days != expected || days * 86400 != (int64_t) rk_timegm(&tm)) {
+                    fprintf(stderr, "%04d-%02d-%02d: got %lld, want %lld\n", year, mon1, day1, (long long) days, (long long) expected);
+                    exit(1);
+                }
+                expected++;
+            }
+        }
+    }
+
+    // Benchmark a date like the RTC's
+    volatile int year = 2026;
+    int64_t sum = 0;
+    uint64_t began = benchNs();
+    for (int i=0; i<BENCH_CALLS; i++) {
+        sum += civilDaysFromDate(year, 10, 19);
+    }
+    double civilNs = (double) (benchNs() - began) / BENCH_CALLS;
+    began = benchNs();
+    for (int i=0; i<BENCH_CALLS; i++) {
+        struct tm tm = {0};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = 9;
+        tm.tm_mday = 19;
+        sum -= rk_timegm(&tm) / 86400;
+    }
+    double loopNs = (double) (benchNs() - began) / BENCH_CALLS;
+    CHECK(sum == 0);
+    printf("civilDaysFromDate %.1fns, year loop %.1fns\n", civilNs, loopNs);
+
+    printf("ok\n");
+    return 0;
+}
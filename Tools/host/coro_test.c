@@ -0,0 +1,319 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks coroutines by running them through a stand-in for the job task and timer server on a
+// simulated clock: awaits that time out, that are woken early by an ISR, and that are woken
+// spuriously before their condition holds; awaits with timeouts inside while loops, as drivers
+// retry a busy bus; that an await's condition is evaluated once each time the coroutine runs; and
+// that an await whose timer fires early by the clock of timerMs() is re-armed for the remainder.
+
+#include "bench.h"
+#include "coro.h"
+
+#define MAX_JOBS        8
+#define MAX_EVENTS      8
+
+// The simulated clock, and how much earlier than timerMs() says that the timer server fires
+STATIC int64_t nowMs = 0;
+STATIC uint32_t timerEarlyMs = 0;
+STATIC uint32_t delayedPosts = 0;
+
+// Jobs that have been initialized, and the queue of those posted
+STATIC job *jobs[MAX_JOBS];
+STATIC uint32_t jobCount = 0;
+STATIC job *jobQueue[MAX_JOBS];
+STATIC uint32_t jobQueued = 0;
+
+// Simulated interrupts, which run at the specified time
+typedef struct {
+    int64_t atMs;
+    void (*func)(void *arg);
+    void *arg;
+} simEvent;
+STATIC simEvent events[MAX_EVENTS];
+STATIC uint32_t eventCount = 0;
+
+// The simulated clock
+int64_t timerMs(void)
+{
+    return nowMs;
+}
+
+// Initialize a job, remembering it so that its timer can be run
+void jobInit(job *j, jobFunc func, void *arg, uint32_t priority)
+{
+    memset(j, 0, sizeof(job));
+    j->func = func;
+    j->arg = arg;
+    j->priority = (uint8_t) priority;
+    for (uint32_t i=0; i<jobCount; i++) {
+        if (jobs[i] == j) {
+            return;
+        }
+    }
+    CHECK(jobCount < MAX_JOBS);
+    jobs[jobCount++] = j;
+}
+
+// Queue a job unless it's already queued
+bool jobPost(job *j)
+{
+    if (j->queued) {
+        return false;
+    }
+    CHECK(jobQueued < MAX_JOBS);
+    j->queued = true;
+    jobQueue[jobQueued++] = j;
+    return true;
+}
+
+// Queue a job from an ISR
+bool jobPostFromISR(job *j)
+{
+    return jobPost(j);
+}
+
+// Start a job's timer, which fires timerEarlyMs early but always at least 1ms later
+void jobPostDelayed(job *j, uint32_t delayMs)
+{
+    delayedPosts++;
+    if (delayMs == 0) {
+        jobPost(j);
+        return;
+    }
+    j->timerCreated = true;
+    j->timer.running = true;
+    j->timer.expiresMs = nowMs + delayMs - GMIN(timerEarlyMs, delayMs-1);
+}
+
+// Stop a timer
+UTIL_TIMER_Status_t UTIL_TIMER_Stop(UTIL_TIMER_Object_t *timer)
+{
+    timer->running = false;
+    return UTIL_TIMER_OK;
+}
+
+// Cancel a job's timer and remove it from the queue
+void jobCancel(job *j)
+{
+    j->timer.running = false;
+    for (uint32_t i=0; i<jobQueued; i++) {
+        if (jobQueue[i] == j) {
+            memmove(&jobQueue[i], &jobQueue[i+1], (jobQueued-i-1) * sizeof(job *));
+            jobQueued--;
+            break;
+        }
+    }
+    j->queued = false;
+}
+
+// See whether a job is queued or its timer is running
+bool jobIsPending(job *j)
+{
+    return j->queued || (j->timerCreated && j->timer.running);
+}
+
+// Schedule a simulated interrupt
+static void simAt(int64_t atMs, void (*func)(void *arg), void *arg)
+{
+    CHECK(eventCount < MAX_EVENTS);
+    events[eventCount++] = (simEvent) {atMs, func, arg};
+}
+
+// Run queued jobs, advancing the clock to each timer and interrupt in turn, up to untilMs
+static void simRun(int64_t untilMs)
+{
+    while (true) {
+        if (jobQueued > 0) {
+            job *j = jobQueue[0];
+            memmove(&jobQueue[0], &jobQueue[1], (jobQueued-1) * sizeof(job *));
+            jobQueued--;
+            j->queued = false;
+            j->func(j->arg);
+            continue;
+        }
+        int64_t nextMs = INT64_MAX;
+        for (uint32_t i=0; i<jobCount; i++) {
+            if (jobs[i]->timer.running) {
+                nextMs = GMIN(nextMs, jobs[i]->timer.expiresMs);
+            }
+        }
+        for (uint32_t i=0; i<eventCount; i++) {
+            nextMs = GMIN(nextMs, events[i].atMs);
+        }
+        if (nextMs > untilMs) {
+            nowMs = untilMs;
+            return;
+        }
+        nowMs = GMAX(nowMs, nextMs);
+        for (uint32_t i=0; i<jobCount; i++) {
+            if (jobs[i]->timer.running && jobs[i]->timer.expiresMs <= nowMs) {
+                jobs[i]->timer.running = false;
+                jobPostFromISR(jobs[i]);
+            }
+        }
+        for (uint32_t i=0; i<eventCount; i++) {
+            if (events[i].atMs <= nowMs) {
+                simEvent e = events[i];
+                events[i--] = events[--eventCount];
+                e.func(e.arg);
+            }
+        }
+    }
+}
+
+// Reset the simulation
+static void simReset(void)
+{
+    CHECK(jobQueued == 0 && eventCount == 0);
+    nowMs = 0;
+    timerEarlyMs = 0;
+    delayedPosts = 0;
+}
+
+// What a test coroutine awaits, and what it saw
+typedef struct {
+    bool ready;
+    uint32_t runs;
+    uint32_t evaluations;
+    uint32_t attempts;
+    uint32_t succeedOnAttempt;
+    uint32_t timeouts;
+    bool timedOut;
+    int64_t resumedMs;
+    int64_t finishedMs;
+} testState;
+STATIC coro testCoro;
+STATIC testState state;
+
+// The awaited condition, counting how often it's evaluated
+static bool testReady(testState *s)
+{
+    s->evaluations++;
+    return s->ready;
+}
+
+// Interrupts that wake the coroutine, with or without making its condition true
+static void isrReady(void *arg)
+{
+    ((testState *) testCoro.arg)->ready = true;
+    coroWakeFromISR(&testCoro);
+}
+static void isrSpurious(void *arg)
+{
+    coroWakeFromISR(&testCoro);
+}
+
+// Await the condition once, for up to 100ms
+static bool awaitOnce(coro *c)
+{
+    testState *s = (testState *) c->arg;
+    s->runs++;
+    CORO_BEGIN(c);
+    CORO_AWAIT_TIMEOUT(c, testReady(s), 100);
+    s->timedOut = coroTimedOut(c);
+    s->resumedMs = timerMs();
+    CORO_END(c);
+}
+
+// Retry until an attempt succeeds, sleeping between attempts, and then await the condition up to
+// three times, as drivers do when the bus is busy
+static bool retryLoop(coro *c)
+{
+    testState *s = (testState *) c->arg;
+    s->runs++;
+    CORO_BEGIN(c);
+    s->attempts = 1;
+    while (s->attempts < s->succeedOnAttempt) {
+        CORO_SLEEP(c, 5);
+        s->attempts++;
+    }
+    s->resumedMs = timerMs();
+    s->timeouts = 0;
+    while (s->timeouts < 3) {
+        CORO_AWAIT_TIMEOUT(c, testReady(s), 20);
+        if (!coroTimedOut(c)) {
+            break;
+        }
+        s->timeouts++;
+    }
+    s->finishedMs = timerMs();
+    CORO_END(c);
+}
+
+// Start a test coroutine with fresh state
+static void testStart(coroFunc func, uint32_t succeedOnAttempt)
+{
+    simReset();
+    memset(&state, 0, sizeof(state));
+    state.succeedOnAttempt = succeedOnAttempt;
+    coroStart(&testCoro, func, &state, JOB_PRI_NORMAL);
+}
+
+int main(void)
+{
+
+    // An await that nothing satisfies times out when its deadline passes, and not before
+    testStart(awaitOnce, 0);
+    simRun(99);
+    CHECK(!coroIsDone(&testCoro));
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.timedOut && state.resumedMs == 100);
+    CHECK(state.runs == 2 && state.evaluations == state.runs);
+
+    // An ISR that satisfies the await wakes it early, and its timer is stopped
+    testStart(awaitOnce, 0);
+    simAt(30, isrReady, NULL);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && !state.timedOut && state.resumedMs == 30);
+    CHECK(state.runs == 2 && state.evaluations == state.runs);
+    CHECK(!jobIsPending(&testCoro.job) && testCoro.deadlineMs == 0);
+
+    // A spurious wake re-evaluates the condition once and keeps waiting, on the same deadline
+    testStart(awaitOnce, 0);
+    simAt(10, isrSpurious, NULL);
+    simAt(50, isrReady, NULL);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && !state.timedOut && state.resumedMs == 50);
+    CHECK(state.runs == 3 && state.evaluations == state.runs);
+    testStart(awaitOnce, 0);
+    simAt(10, isrSpurious, NULL);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.timedOut && state.resumedMs == 100);
+    CHECK(delayedPosts == 1);
+
+    // A timer that fires early by timerMs() is re-armed for the remainder rather than timing out
+    testStart(awaitOnce, 0);
+    timerEarlyMs = 7;
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.timedOut && state.resumedMs == 100);
+    CHECK(delayedPosts > 1);
+    CHECK(state.evaluations == state.runs);
+
+    // Sleeps and awaits with timeouts inside while loops resume where they left off
+    testStart(retryLoop, 4);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.attempts == 4 && state.resumedMs == 15);
+    CHECK(state.timeouts == 3 && state.finishedMs == 75);
+    CHECK(state.evaluations == 6);
+
+    // Satisfying an await partway through the loop ends it there
+    testStart(retryLoop, 2);
+    simAt(40, isrReady, NULL);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.resumedMs == 5);
+    CHECK(state.timeouts == 1 && state.finishedMs == 40);
+    CHECK(!jobIsPending(&testCoro.job));
+
+    // A coroutine that is restarted while it waits starts over
+    testStart(awaitOnce, 0);
+    simRun(50);
+    memset(&state, 0, sizeof(state));
+    coroStart(&testCoro, awaitOnce, &state, JOB_PRI_NORMAL);
+    simRun(1000);
+    CHECK(coroIsDone(&testCoro) && state.timedOut && state.resumedMs == 150 && state.runs == 2);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks fmtString against the C library's snprintf over flags, widths, precisions, integer
+// sizes and floating point values, checks the documented deviations, and benchmarks both.
+
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include "bench.h"
+
+#define BENCH_CALLS     1000000
+
+// Check fmtString against what vsnprintf makes of the same format and arguments
+static void fmtCheck(const char *format, ...)
+{
+    char got[256], want[256];
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    uint32_t len = fmtStringV(got, sizeof(got), format, args);
+    vsnprintf(want, sizeof(want), format, copy);
+    va_end(copy);
+    va_end(args);
+    if (strcmp(got, want) != 0 || len != strlen(want)) {
+        fprintf(stderr, "mismatch for \"%s\"\n  got: [%s]\n want: [%s]\n", format, got, want);
+        exit(1);
+    }
+}
+
+// Check fmtString against the expected output
+static void fmtExpect(const char *want, const char *format, ...)
+{
+    char got[256];
+    va_list args;
+    va_start(args, format);
+    fmtStringV(got, sizeof(got), format, args);
+    va_end(args);
+    if (strcmp(got, want) != 0) {
+        fprintf(stderr, "mismatch for \"%s\"\n  got: [%s]\n want: [%s]\n", format, got, want);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+
+    // Integers, across flags, widths, precisions and sizes
+    static const char *intFormats[] = {
+        "%d", "%5d", "%-5d|", "%05d", "%+d", "% d", "%.3d", "%8.3d", "%-8.3d|", "%.0d",
+        "%u", "%x", "%X", "%#x", "%#X", "%#o", "%o", "%08x", "%#010x", "%+.0d",
+    };
+    static const int intValues[] = {0, 1, -1, 7, 42, -42, 255, 65535, -65536, INT_MAX, INT_MIN};
+    for (uint32_t f=0; f<sizeof(intFormats)/sizeof(intFormats[0]); f++) {
+        for (uint32_t v=0; v<sizeof(intValues)/sizeof(intValues[0]); v++) {
+            fmtCheck(intFormats[f], intValues[v]);
+        }
+    }
+    fmtCheck("%hd %hhd %hu %hhu", 70000, 300, 70000, 300);
+    fmtCheck("%ld %lu %lx", LONG_MIN, ULONG_MAX, LONG_MAX);
+    fmtCheck("%lld %llu %llx %jd", LLONG_MIN, ULLONG_MAX, LLONG_MAX, (intmax_t) LLONG_MIN);
+    fmtCheck("%zu %zd %td", (size_t) 123456789, (size_t) 5, (ptrdiff_t) -9);
+    fmtCheck("%*d|%-*d|%*d", 6, 12, 6, 12, -6, 12);
+
+    // Characters, strings and pointers
+    fmtCheck("%c%c%3c%-3c|", 'a', 'b', 'c', 'd');
+    fmtCheck("%s|%10s|%-10s|%.2s|%10.2s|%.*s|%.0s", "hello", "hello", "hello", "hello", "hello", 3, "hello", "hello");
+    fmtCheck("%p %p", (void *) 0x1234, (void *) &fmtCheck);
+    fmtCheck("100%% %5%|");
+
+    // Floating point within the documented range
+    static const char *floatFormats[] = {
+        "%f", "%.0f", "%.1f", "%.3f", "%.9f", "%10.2f", "%-10.2f|", "%010.2f", "%+f", "% f", "%#.0f",
+        "%e", "%.0e", "%.3e", "%E", "%12.4e", "%+e",
+        "%g", "%.3g", "%.9g", "%.10g", "%G", "%10g",
+    };
+    static const double floatValues[] = {
+        0.0, 1.0, -1.0, 0.5, 1.5, 2.5, 0.125, 3.14159265358979, -2.718281828, 100.0, 123456.789,
+        1e-5, 0.0001, 9.9999999, 999999.5, 1e10, 1.23e15, 1.8e19, -4.5e-3,
+    };
+    for (uint32_t f=0; f<sizeof(floatFormats)/sizeof(floatFormats[0]); f++) {
+        for (uint32_t v=0; v<sizeof(floatValues)/sizeof(floatValues[0]); v++) {
+            fmtCheck(floatFormats[f], floatValues[v]);
+        }
+    }
+    fmtCheck("%#g %#g %#g %#.3g", 1.0, 0.0001, 123456.789, 2.5);
+    fmtCheck("%f %F %e %5f|%-5f|", INFINITY, -INFINITY, NAN, INFINITY, NAN);
+
+    // The documented deviations from the C library
+    fmtExpect("3.141592654", "%.12f", 3.14159265358979);
+    fmtExpect("3.141592654e+00", "%.12e", 3.14159265358979);
+    fmtExpect("2.000000e+19", "%f", 2e19);
+    fmtExpect("%n", "%n");
+
+    // Output is truncated to the buffer but always terminated
+    char small[6];
+    CHECK(fmtString(small, sizeof(small), "%s", "truncated") == 5);
+    CHECK(strcmp(small, "trunc") == 0);
+
+    // Benchmark a typical log line
+    char buf[128];
+    uint64_t began = benchNs();
+    for (int i=0; i<BENCH_CALLS; i++) {
+        fmtString(buf, sizeof(buf), "port %s: %d bytes at %08x (%.2f%%)", "usb", i, i * 16, i / 1000.0);
+    }
+    double fmtSecs = (double) (benchNs() - began) / 1e9;
+    began = benchNs();
+    for (int i=0; i<BENCH_CALLS; i++) {
+        snprintf(buf, sizeof(buf), "port %s: %d bytes at %08x (%.2f%%)", "usb", i, i * 16, i / 1000.0);
+    }
+    double libcSecs = (double) (benchNs() - began) / 1e9;
+    printf("fmtString %.0f calls/sec, snprintf %.0f calls/sec\n", BENCH_CALLS / fmtSecs, BENCH_CALLS / libcSecs);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks that lazily-formatted errors read back exactly as vsnprintf would have formatted them
+// when they were raised, even after the buffers that their arguments came from have changed,
+// and benchmarks how many errors per second errF can raise.  Static errors are only
+// distinguished by their address being in flash, so on the host they are ordinary errors.
+
+#include "bench.h"
+
+#define BENCH_ERRORS    1000000
+
+// Check an error's text against what vsnprintf makes of the same format and arguments
+static void errCheck(err_t err, const char *format, ...)
+{
+    char want[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(want, sizeof(want), format, args);
+    va_end(args);
+    if (strcmp(errString(err), want) != 0) {
+        fprintf(stderr, "mismatch\n  got: [%s]\n want: [%s]\n", errString(err), want);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+
+    // Arguments are captured when the error is raised, not when it is formatted
+    char transient[64];
+    strlcpy(transient, "transient", sizeof(transient));
+    err_t err = errF("plain");
+    errCheck(err, "plain");
+    err = errF("a %d b %5u c %-4x| %ld %lld %zu %s %.3s %*d %.*f %c %%", -3, 7u, 255, 123456789L,
+               1234567890123LL, (size_t) 9, transient, "abcdef", 6, 42, 2, 3.14159, 'z');
+    strlcpy(transient, "CHANGED", sizeof(transient));
+    errCheck(err, "a %d b %5u c %-4x| %ld %lld %zu %s %.3s %*d %.*f %c %%", -3, 7u, 255, 123456789L,
+             1234567890123LL, (size_t) 9, "transient", "abcdef", 6, 42, 2, 3.14159, 'z');
+
+    // A string with a precision need not be terminated, and is read no further than that
+    char unterminated[4] = {'a', 'b', 'c', 'd'};
+    err = errF("[%.*s] [%.2s]", 3, unterminated, unterminated);
+    errCheck(err, "[abc] [ab]");
+
+    // Non-printable characters are sanitized
+    err = errF("bin %s", "a\001b");
+    errCheck(err, "bin a?b");
+
+    // Repeats of the same error are the same error, and different ones are not
+    err_t busy1 = errF("busy %d", 1);
+    err_t busy1Again = errF("busy %d", 1);
+    CHECK(busy1 == busy1Again);
+    err_t busy2 = errF("busy %d", 2);
+    CHECK(busy2 != busy1);
+    errCheck(busy2, "busy 2");
+    errCheck(busy1, "busy 1");
+
+    // Static errors read back as their literal text, with no formatting
+    err = errStatic("static error");
+    CHECK(err != errNone);
+    errCheck(err, "static error");
+    err = errStatic("100% static");
+    CHECK(strcmp(errString(err), "100% static") == 0);
+
+    // Long errors are truncated, and errors may be built from other errors
+    char big[300];
+    memset(big, 'x', sizeof(big)-1);
+    big[sizeof(big)-1] = '\0';
+    err = errF("big %s!", big);
+    CHECK(strlen(errString(err)) == 255);
+    err = errF("cascade: %s", errString(busy2));
+    errCheck(err, "cascade: busy 2");
+
+    // Benchmark errors that are raised and discarded without ever being formatted
+    uint64_t began = benchNs();
+    for (int i=0; i<BENCH_ERRORS; i++) {
+        err = errF("timeout after %d ms on %s", i, "port");
+    }
+    double lazySecs = (double) (benchNs() - began) / 1e9;
+    errCheck(err, "timeout after %d ms on %s", BENCH_ERRORS-1, "port");
+    began = benchNs();
+    for (int i=0; i<BENCH_ERRORS; i++) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "timeout after %d ms on %s", i, "port");
+    }
+    double snprintfSecs = (double) (benchNs() - began) / 1e9;
+    printf("errF: %.1fM errors/sec (snprintf alone: %.1fM/sec)\n",
+           BENCH_ERRORS / lazySecs / 1e6, BENCH_ERRORS / snprintfSecs / 1e6);
+
+    printf("ok\n");
+    return 0;
+}
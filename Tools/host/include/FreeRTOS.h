@@ -0,0 +1,30 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for FreeRTOS.h, providing the heap from the C library, and the task types and
+// notifications that the rings use, whose functions are provided by the tests that need them
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define pvPortMalloc(size)          malloc(size)
+#define vPortFree(p)                free(p)
+#define xPortGetFreeHeapSize()      ((size_t) 0)
+
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+#define pdFALSE                     ((BaseType_t) 0)
+#define pdTRUE                      ((BaseType_t) 1)
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+void vTaskDelay(TickType_t ticks);
+void hostEnterCritical(void);
+void hostExitCritical(void);
+#define taskENTER_CRITICAL()        hostEnterCritical()
+#define taskEXIT_CRITICAL()         hostExitCritical()
+#define portYIELD_FROM_ISR(x)       ((void) (x))
@@ -0,0 +1,7 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for board.h.  FLASH_BASE and FLASH_END are left undefined, so there are no
+// static errors in flash.
+#pragma once
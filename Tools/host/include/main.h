@@ -0,0 +1,9 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the HAL's main.h, which the modules under test include only for types
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
@@ -0,0 +1,23 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for mutex.h.  The modules that use mutexes are tested single-threaded, so
+// mutexes do nothing.  The rings are lock-free and are the real thing.
+#pragma once
+
+#include "global.h"
+#include "FreeRTOS.h"
+#include "ring.h"
+
+#define MTX_TIME        0x0000000000000002
+#define MTX_ERR         0x0000000000000020
+typedef uint64_t mtxtype_t;
+typedef struct {
+    mtxtype_t mtx;
+    struct {
+        bool initialized;
+    } state;
+} mutex;
+#define mutexLock(m)    ((void) (m))
+#define mutexUnlock(m)  ((void) (m))
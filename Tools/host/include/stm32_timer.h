@@ -0,0 +1,19 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the timer server's stm32_timer.h, whose timers the tests that need them
+// keep on a simulated clock
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    UTIL_TIMER_OK = 0,
+} UTIL_TIMER_Status_t;
+typedef struct {
+    bool running;
+    int64_t expiresMs;
+} UTIL_TIMER_Object_t;
+UTIL_TIMER_Status_t UTIL_TIMER_Stop(UTIL_TIMER_Object_t *TimerObject);
@@ -0,0 +1,94 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks and benchmarks arrayMap lookups at 16, 64 and 256 keys, linearly and through the hash
+// index both case-sensitive and case-folded, and checks that removal keeps the map's order.
+
+#include "bench.h"
+
+#define LOOKUP_ROUNDS   200000
+
+// Build a map of the specified number of keys, whose values are their positions
+static arrayMap *mapBuild(int keys)
+{
+    arrayMap *map;
+    CHECK(arrayMapAlloc(sizeof(uint32_t), NULL, sizeof(uint32_t), NULL, &map) == errNone);
+    for (int i=0; i<keys; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "X-Header-%d", i);
+        uint32_t v1 = i, v2 = i*2;
+        CHECK(arrayMapSet(map, false, name, &v1, &v2) == errNone);
+    }
+    return map;
+}
+
+// Look up every key of a map repeatedly, returning nanoseconds per lookup
+static double mapLookups(arrayMap *map, int keys, bool caseSensitive)
+{
+    char names[256][32];
+    for (int i=0; i<keys; i++) {
+        snprintf(names[i], sizeof(names[i]), caseSensitive ? "X-Header-%d" : "x-header-%d", i);
+    }
+    uint32_t rounds = LOOKUP_ROUNDS / keys;
+    uint64_t began = benchNs();
+    for (uint32_t r=0; r<rounds; r++) {
+        for (int i=0; i<keys; i++) {
+            uint32_t *v1, *v2;
+            CHECK(arrayMapGet(map, caseSensitive, names[i], &v1, &v2));
+            CHECK(*v1 == (uint32_t) i && *v2 == (uint32_t) i*2);
+        }
+    }
+    return (double) (benchNs() - began) / ((double) rounds * keys);
+}
+
+// Check that removal keeps the remaining entries findable and in their original order
+static void mapCheckRemove(int keys)
+{
+    arrayMap *map = mapBuild(keys);
+    CHECK(arrayMapIndex(map, false) == errNone);
+    for (int i=0; i<keys; i+=3) {
+        char name[32];
+        snprintf(name, sizeof(name), "x-header-%d", i);
+        CHECK(arrayMapRemove(map, false, name) == errNone);
+    }
+    arrayMapShrink(map);
+    int expect = 1;
+    for (int i=0; i<map->count; i++) {
+        char *name;
+        uint32_t *v1;
+        CHECK(arrayMapEntry(map, i, &name, &v1, NULL));
+        CHECK(*v1 == (uint32_t) expect);
+        uint32_t *found;
+        CHECK(arrayMapGet(map, true, name, &found, NULL) && found == v1);
+        expect += (expect % 3 == 2) ? 2 : 1;
+    }
+    arrayMapFree(map);
+}
+
+int main(void)
+{
+    printf("%-6s %12s %12s %12s\n", "keys", "linear ns", "hashed ns", "hashed-ci ns");
+    int keyCounts[] = {16, 64, 256};
+    for (int k=0; k<sizeof(keyCounts)/sizeof(keyCounts[0]); k++) {
+        int keys = keyCounts[k];
+        arrayMap *linear = mapBuild(keys);
+        arrayMap *hashed = mapBuild(keys);
+        CHECK(arrayMapIndex(hashed, true) == errNone);
+        arrayMap *folded = mapBuild(keys);
+        CHECK(arrayMapIndex(folded, false) == errNone);
+        double linearNs = mapLookups(linear, keys, true);
+        double hashedNs = mapLookups(hashed, keys, true);
+        double foldedNs = mapLookups(folded, keys, false);
+        printf("%-6d %12.1f %12.1f %12.1f\n", keys, linearNs, hashedNs, foldedNs);
+        arrayMapFree(linear);
+        arrayMapFree(hashed);
+        arrayMapFree(folded);
+        mapCheckRemove(keys);
+    }
+
+    extern long memObjects;
+    CHECK(memObjects == 0);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,255 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks the lock-free rings with threads standing in for tasks and ISRs: put and get through
+// full and empty and across laps of the positions, timeouts, a blocked get woken by a put,
+// several task and ISR producers claiming positions at once with nothing lost or reordered, and
+// that no notification is left behind to wake a later taskTake().  Notifications are a count per
+// thread, critical sections are one lock, and an "ISR" holds that lock while it runs, because
+// on the device an ISR can't interrupt a critical section and a task can't interrupt an ISR.
+
+#include <pthread.h>
+#include "bench.h"
+#include "mutex.h"
+
+#define PRODUCERS       4
+#define PER_PRODUCER    50000
+#define ISR_PUTS        50000
+
+// Tasks' notification counts
+typedef struct {
+    uint32_t count;
+} hostTask;
+static __thread hostTask thisTask;
+static pthread_mutex_t notifyLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notifyCond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t criticalLock;
+
+// Milliseconds from the monotonic clock, standing in for timer.c
+int64_t timerMs(void)
+{
+    return (int64_t) (benchNs() / 1000000);
+}
+
+// The current task
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &thisTask;
+}
+
+// Take a notification, waiting up to the specified number of ticks, which are milliseconds
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    uint64_t ns = (uint64_t) until.tv_nsec + (uint64_t) ticksToWait * 1000000;
+    until.tv_sec += (time_t) (ns / 1000000000);
+    until.tv_nsec = (long) (ns % 1000000000);
+    pthread_mutex_lock(&notifyLock);
+    while (thisTask.count == 0 && ticksToWait != 0) {
+        if (pthread_cond_timedwait(&notifyCond, &notifyLock, &until) != 0) {
+            break;
+        }
+    }
+    uint32_t count = thisTask.count;
+    if (count != 0) {
+        thisTask.count = clearCountOnExit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&notifyLock);
+    return count;
+}
+
+// Give a task a notification
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&notifyLock);
+    ((hostTask *) task)->count++;
+    pthread_cond_broadcast(&notifyCond);
+    pthread_mutex_unlock(&notifyLock);
+}
+
+// Give a task a notification from an ISR
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+    xTaskNotifyGive(task);
+    *higherPriorityTaskWoken = pdTRUE;
+}
+
+// Sleep for the specified number of ticks, which are milliseconds
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {ticks / 1000, (long) (ticks % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+// Critical sections, which nest
+void hostEnterCritical(void)
+{
+    pthread_mutex_lock(&criticalLock);
+}
+void hostExitCritical(void)
+{
+    pthread_mutex_unlock(&criticalLock);
+}
+
+// See how many notifications the current task has pending
+static uint32_t notificationsPending(void)
+{
+    pthread_mutex_lock(&notifyLock);
+    uint32_t count = thisTask.count;
+    pthread_mutex_unlock(&notifyLock);
+    return count;
+}
+
+// Entries put by the producers, which say who put them and in what order
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} entry;
+
+// Producer tasks
+typedef struct {
+    taskRing *ring;
+    uint32_t producer;
+    uint32_t leftover;
+} producerArgs;
+static void *producerTask(void *arg)
+{
+    producerArgs *p = arg;
+    for (uint32_t i=0; i<PER_PRODUCER; i++) {
+        entry e = {p->producer, i};
+        CHECK(taskRingPut(p->ring, &e, 5000));
+    }
+    p->leftover = notificationsPending();
+    return NULL;
+}
+
+// An ISR producer, retrying when the ring is full as a device would on its next interrupt
+static void *producerISR(void *arg)
+{
+    producerArgs *p = arg;
+    for (uint32_t i=0; i<ISR_PUTS; i++) {
+        entry e = {p->producer, i};
+        while (true) {
+            hostEnterCritical();
+            bool put = taskRingPutFromISR(p->ring, &e);
+            hostExitCritical();
+            if (put) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// A consumer task that gets a single entry
+typedef struct {
+    taskRing *ring;
+    uint32_t value;
+    bool success;
+    int64_t waitedMs;
+} consumerArgs;
+static void *consumerTask(void *arg)
+{
+    consumerArgs *c = arg;
+    int64_t began = timerMs();
+    c->success = taskRingGet(c->ring, &c->value, 2000);
+    c->waitedMs = timerMs() - began;
+    CHECK(notificationsPending() == 0);
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&criticalLock, &attr);
+
+    // Entries are rounded up to a power of two, and put and get run through full and empty
+    taskRing *ring;
+    CHECK(taskRingAlloc(sizeof(uint32_t), 5, false, &ring));
+    CHECK(ring->mask == 7);
+    uint32_t value = 0;
+    CHECK(!taskRingGet(ring, &value, 0));
+    for (uint32_t lap=0; lap<1000; lap++) {
+        for (uint32_t i=0; i<8; i++) {
+            uint32_t v = lap*8 + i;
+            CHECK(taskRingPut(ring, &v, 0));
+        }
+        CHECK(taskRingPending(ring) == 8);
+        uint32_t v = 0;
+        CHECK(!taskRingPut(ring, &v, 0));
+        CHECK(!taskRingPutFromISR(ring, &v));
+        for (uint32_t i=0; i<8; i++) {
+            CHECK(taskRingGet(ring, &value, 0));
+            CHECK(value == lap*8 + i);
+        }
+        CHECK(taskRingPending(ring) == 0);
+    }
+
+    // Waits time out, and leave no notifications behind
+    int64_t began = timerMs();
+    CHECK(!taskRingGet(ring, &value, 30));
+    CHECK(timerMs() - began >= 30);
+    CHECK(ring->consumer == NULL);
+    for (uint32_t i=0; i<8; i++) {
+        CHECK(taskRingPut(ring, &i, 0));
+    }
+    began = timerMs();
+    CHECK(!taskRingPut(ring, &value, 30));
+    CHECK(timerMs() - began >= 30);
+    CHECK(ring->producer == NULL);
+    CHECK(notificationsPending() == 0);
+    while (taskRingGet(ring, &value, 0)) {
+    }
+
+    // A blocked get is woken by a put rather than waiting out its timeout
+    consumerArgs consumer = {ring, 0, false, 0};
+    pthread_t consumerThread;
+    CHECK(pthread_create(&consumerThread, NULL, consumerTask, &consumer) == 0);
+    vTaskDelay(50);
+    value = 1234;
+    CHECK(taskRingPut(ring, &value, 0));
+    pthread_join(consumerThread, NULL);
+    CHECK(consumer.success && consumer.value == 1234 && consumer.waitedMs < 1000);
+    taskRingFree(ring);
+
+    // Task and ISR producers contend for positions, and the consumer sees each one's entries
+    // complete and in the order that it put them
+    CHECK(taskRingAlloc(sizeof(entry), 16, true, &ring));
+    producerArgs producers[PRODUCERS+1];
+    pthread_t producerThreads[PRODUCERS+1];
+    for (uint32_t p=0; p<=PRODUCERS; p++) {
+        producers[p].ring = ring;
+        producers[p].producer = p;
+        producers[p].leftover = 0;
+        CHECK(pthread_create(&producerThreads[p], NULL, p < PRODUCERS ? producerTask : producerISR, &producers[p]) == 0);
+    }
+    uint32_t next[PRODUCERS+1] = {0};
+    uint32_t total = PRODUCERS*PER_PRODUCER + ISR_PUTS;
+    began = timerMs();
+    for (uint32_t i=0; i<total; i++) {
+        entry e;
+        CHECK(taskRingGet(ring, &e, 5000));
+        CHECK(e.producer <= PRODUCERS);
+        CHECK(e.seq == next[e.producer]);
+        next[e.producer]++;
+    }
+    double secs = (double) (timerMs() - began) / 1000;
+    for (uint32_t p=0; p<=PRODUCERS; p++) {
+        pthread_join(producerThreads[p], NULL);
+        CHECK(producers[p].leftover == 0);
+    }
+    CHECK(!taskRingGet(ring, &value, 0));
+    CHECK(notificationsPending() == 0);
+    CHECK(ring->consumer == NULL && ring->producer == NULL);
+    taskRingFree(ring);
+
+    printf("%lu entries from %d producers through a 16-entry ring at %.1fM entries/sec\n",
+           (unsigned long) total, PRODUCERS+1, total / secs / 1e6);
+    printf("ok\n");
+    return 0;
+}
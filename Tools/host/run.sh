@@ -0,0 +1,38 @@
+#!/bin/sh
+# Copyright 2024 Blues Inc.  All rights reserved.
+# Use of this source code is governed by licenses granted by the
+# copyright holder including that found in the LICENSE file.
+
+# Build and run the host tests and benchmarks, each against the System/Global modules that it
+# exercises.  Run from anywhere; set CC or CFLAGS to override the compiler or its options.
+# Modules are copied out of System/Global before they are compiled so that their includes of
+# mutex.h, main.h and board.h find the stand-ins in include/ rather than the device headers.
+set -e
+HOST=$(cd "$(dirname "$0")" && pwd)
+GLOBAL="$HOST/../../System/Global"
+OUT="${OUT:-/tmp/hosttest}"
+CC="${CC:-cc}"
+CFLAGS="${CFLAGS:--O2 -std=gnu11 -Wall -Wno-unused-function}"
+mkdir -p "$OUT/src"
+
+run() {
+    name=$1
+    shift
+    srcs=""
+    for m in "$@"; do
+        cp "$GLOBAL/$m.c" "$OUT/src/$m.c"
+        srcs="$srcs $OUT/src/$m.c"
+    done
+    echo "== $name"
+    $CC $CFLAGS -I"$HOST/include" -I"$GLOBAL" -o "$OUT/$name" "$HOST/$name.c" "$HOST/stubs.c" $srcs -lm -lpthread
+    "$OUT/$name"
+}
+
+run array_test array gmem strl gerr fmt prof
+run map_bench array gmem strl gerr fmt prof
+run ring_test ring gmem gerr fmt array strl prof
+run sort_bench array gmem strl gerr fmt prof
+run gerr_test gerr fmt array strl gmem prof
+run fmt_test fmt array gerr strl gmem prof
+run civil_test civil timegm
+run coro_test coro
@@ -0,0 +1,141 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks and benchmarks arraySort on fixed-size, large and string entries from 16 to 4096 of
+// them, and arraySortIndex on the large entries, against the libc qsort for reference, and
+// checks that the sorts are stable.
+
+#include "bench.h"
+
+// Compare uint32_t entries
+static bool u32Less(void *a, void *b)
+{
+    return * (uint32_t *) a < * (uint32_t *) b;
+}
+static int u32Compare(const void *a, const void *b)
+{
+    uint32_t x = * (uint32_t *) a, y = * (uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+// A large entry, sorted by key with seq recording the original order
+typedef struct {
+    uint32_t key;
+    uint32_t seq;
+    uint8_t payload[56];
+} bigEntry;
+static bool bigLess(void *a, void *b)
+{
+    return ((bigEntry *) a)->key < ((bigEntry *) b)->key;
+}
+static int bigCompare(const void *a, const void *b)
+{
+    return u32Compare(&((bigEntry *) a)->key, &((bigEntry *) b)->key);
+}
+
+// Compare string entries
+static bool strLess(void *a, void *b)
+{
+    return strcmp(a, b) < 0;
+}
+
+// Time sorting n uint32_t entries, checking the result
+static void sortU32(int n, double *arrayNs, double *qsortNs)
+{
+    array *a;
+    CHECK(arrayAlloc(sizeof(uint32_t), NULL, &a) == errNone);
+    a->isLessFn = u32Less;
+    uint32_t *ref = malloc(n * sizeof(uint32_t));
+    for (int i=0; i<n; i++) {
+        uint32_t v = (uint32_t) rand() % 1000;
+        CHECK(arrayAppend(a, &v) == errNone);
+        ref[i] = v;
+    }
+    uint64_t began = benchNs();
+    CHECK(arraySort(a) == errNone);
+    *arrayNs = (double) (benchNs() - began);
+    began = benchNs();
+    qsort(ref, n, sizeof(uint32_t), u32Compare);
+    *qsortNs = (double) (benchNs() - began);
+    CHECK(memcmp(a->address, ref, n * sizeof(uint32_t)) == 0);
+    free(ref);
+    arrayFree(a);
+}
+
+// Time sorting n large entries, both by index and in place, checking that both results are
+// sorted and stable
+static void sortBig(int n, double *indexNs, double *arrayNs, double *qsortNs)
+{
+    array *a;
+    CHECK(arrayAlloc(sizeof(bigEntry), NULL, &a) == errNone);
+    a->isLessFn = bigLess;
+    bigEntry *ref = malloc(n * sizeof(bigEntry));
+    for (int i=0; i<n; i++) {
+        bigEntry e = {0};
+        e.key = (uint32_t) rand() % 100;
+        e.seq = i;
+        CHECK(arrayAppend(a, &e) == errNone);
+        ref[i] = e;
+    }
+    uint16_t *index = malloc(n * sizeof(uint16_t));
+    uint64_t began = benchNs();
+    CHECK(arraySortIndex(a, index) == errNone);
+    *indexNs = (double) (benchNs() - began);
+    for (int i=1; i<n; i++) {
+        bigEntry *prev = arrayEntry(a, index[i-1]), *cur = arrayEntry(a, index[i]);
+        CHECK(prev->key < cur->key || (prev->key == cur->key && prev->seq < cur->seq));
+    }
+    free(index);
+    began = benchNs();
+    CHECK(arraySort(a) == errNone);
+    *arrayNs = (double) (benchNs() - began);
+    began = benchNs();
+    qsort(ref, n, sizeof(bigEntry), bigCompare);
+    *qsortNs = (double) (benchNs() - began);
+    for (int i=1; i<n; i++) {
+        bigEntry *prev = arrayEntry(a, i-1), *cur = arrayEntry(a, i);
+        CHECK(prev->key < cur->key || (prev->key == cur->key && prev->seq < cur->seq));
+    }
+    free(ref);
+    arrayFree(a);
+}
+
+// Time sorting n string entries, checking the result
+static void sortStrings(int n, double *arrayNs)
+{
+    array *a;
+    CHECK(arrayAllocString(&a) == errNone);
+    a->isLessFn = strLess;
+    for (int i=0; i<n; i++) {
+        char s[16];
+        snprintf(s, sizeof(s), "s%u", (unsigned) rand() % 100000);
+        CHECK(arrayAppend(a, s) == errNone);
+    }
+    uint64_t began = benchNs();
+    CHECK(arraySort(a) == errNone);
+    *arrayNs = (double) (benchNs() - began);
+    CHECK(arrayEntries(a) == n);
+    for (int i=1; i<n; i++) {
+        CHECK(strcmp(arrayEntry(a, i-1), arrayEntry(a, i)) <= 0);
+    }
+    arrayFree(a);
+}
+
+int main(void)
+{
+    srand(1);
+    printf("%-6s %10s %10s %10s %10s %10s %10s\n", "n", "u32 us", "qsort us", "64B idx us", "64B us", "qsort us", "string us");
+    for (int n=16; n<=4096; n*=4) {
+        double u32Ns, u32QsortNs, bigIndexNs, bigNs, bigQsortNs, strNs;
+        sortU32(n, &u32Ns, &u32QsortNs);
+        sortBig(n, &bigIndexNs, &bigNs, &bigQsortNs);
+        sortStrings(n, &strNs);
+        printf("%-6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", n, u32Ns/1000, u32QsortNs/1000, bigIndexNs/1000, bigNs/1000, bigQsortNs/1000, strNs/1000);
+    }
+
+    extern long memObjects;
+    CHECK(memObjects == 0);
+    printf("ok\n");
+    return 0;
+}
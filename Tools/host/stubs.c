@@ -0,0 +1,55 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-ins for the debug output and the few other routines that System/Global modules
+// take from the rest of the firmware, so that they can be built with the host compiler
+
+#include "global.h"
+
+// Case-insensitive compare
+bool memeqlCI(void *av, void *bv, int len)
+{
+    char *a = av;
+    char *b = bv;
+    for (int i=0; i<len; i++) {
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Panics end the test
+void debugPanic(const char *message)
+{
+    fprintf(stderr, "panic: %s\n", message);
+    abort();
+}
+
+// Soft panics end the test too, because they indicate a bug
+void debugSoftPanic(const char *message)
+{
+    debugPanic(message);
+}
+
+// Debug output goes to stdout
+void debugf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// Raw debug output goes to stdout
+void debugR(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// All modules are enabled at all levels
+uint32_t debugModuleMask[DEBUG_LEVELS] = {DEBUG_ALL, DEBUG_ALL, DEBUG_ALL, DEBUG_ALL};
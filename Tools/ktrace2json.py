@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+# Copyright 2024 Blues Inc.  All rights reserved.
+# Use of this source code is governed by licenses granted by the
+# copyright holder including that found in the LICENSE file.
+
+# Convert the output of the "ktrace" diag command, captured from the debug port, into Chrome
+# trace event JSON that can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.  Each
+# task gets a track showing when it ran, with its mutex waits, notifications and queue activity,
+# each mutex gets a track showing who held it, and ISR markers appear on a track per IRQ.  If the
+# capture holds several dumps, the last is used.  See System/Global/ktrace.c.
+#
+#   ktrace2json.py capture.log > trace.json
+
+import argparse
+import base64
+import json
+import struct
+import sys
+
+RECORD = struct.Struct('<IBBHI')
+
+SWITCH = 1
+MUTEX_BLOCK = 2
+MUTEX_TAKE = 3
+MUTEX_GIVE = 4
+QUEUE_BLOCK = 5
+QUEUE_RECEIVE = 6
+QUEUE_SEND = 7
+NOTIFY = 8
+NOTIFY_BLOCK = 9
+NOTIFY_TAKE = 10
+SLEEP = 11
+RX_COMPLETE = 32
+RX_NOTIFY = 33
+
+INSTANTS = {
+    QUEUE_BLOCK: 'queue wait',
+    QUEUE_RECEIVE: 'queue receive',
+    QUEUE_SEND: 'queue send',
+    NOTIFY_BLOCK: 'notify wait',
+    NOTIFY_TAKE: 'notify take',
+    RX_COMPLETE: 'rx complete',
+    RX_NOTIFY: 'rx notify',
+}
+
+PID = 1
+IRQ_TID_BASE = 1000
+MUTEX_TID_BASE = 2000
+
+
+def parse_capture(lines):
+    tasks = {}
+    data = None
+    dump = None
+    for line in lines:
+        i = line.find('ktrace ')
+        if i < 0:
+            continue
+        words = line[i:].split()
+        if words[1] == 'begin':
+            tasks, data = {}, b''
+        elif data is None:
+            continue
+        elif words[1] == 'task' and len(words) >= 4:
+            tasks[int(words[2])] = ' '.join(words[3:])
+        elif words[1] == 'data' and len(words) >= 3:
+            data += base64.b64decode(words[2])
+        elif words[1] == 'end':
+            dump = (tasks, data)
+            data = None
+    return dump
+
+
+def records(data):
+    base = 0
+    last = None
+    for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        us, event, task, irq, arg = RECORD.unpack_from(data, off)
+        if last is not None and us + base < last - (1 << 31):
+            base += 1 << 32
+        last = us + base
+        yield last, event, task, irq, arg
+
+
+def convert(tasks, data):
+    events = []
+    tids = {}
+
+    def task_tid(task):
+        if task not in tids:
+            tids[task] = tasks.get(task, 'startup' if task == 0 else 'task %d' % task)
+        return task
+
+    def irq_tid(irq):
+        tid = IRQ_TID_BASE + irq
+        tids.setdefault(tid, 'irq %d' % (irq - 16) if irq >= 16 else 'exception %d' % irq)
+        return tid
+
+    mutex_tids = {}
+
+    def mutex_tid(mutex):
+        if mutex not in mutex_tids:
+            mutex_tids[mutex] = MUTEX_TID_BASE + len(mutex_tids)
+            tids[mutex_tids[mutex]] = 'mutex 0x%08x' % mutex
+        return mutex_tids[mutex]
+
+    def slice(name, tid, begin, end, args=None):
+        e = {'name': name, 'ph': 'X', 'pid': PID, 'tid': tid, 'ts': begin, 'dur': max(end - begin, 0)}
+        if args:
+            e['args'] = args
+        events.append(e)
+
+    def instant(name, tid, ts, args=None):
+        e = {'name': name, 'ph': 'i', 's': 't', 'pid': PID, 'tid': tid, 'ts': ts}
+        if args:
+            e['args'] = args
+        events.append(e)
+
+    running = None
+    waiting = {}
+    held = {}
+    flows = {}
+    flow_id = 0
+    ts = 0
+    for ts, event, task, irq, arg in records(data):
+        tid = irq_tid(irq) if irq != 0 else task_tid(task)
+        if event == SWITCH:
+            if running is not None:
+                slice(tids[running[0]], running[0], running[1], ts)
+            running = (task_tid(task), ts)
+            for fid in flows.pop(task, []):
+                events.append({'name': 'notify', 'cat': 'notify', 'ph': 'f', 'bp': 'e', 'id': fid, 'pid': PID, 'tid': task, 'ts': ts})
+        elif event == MUTEX_BLOCK:
+            waiting[task] = (arg, ts)
+        elif event == MUTEX_TAKE:
+            if task in waiting and waiting[task][0] == arg:
+                slice('wait mutex 0x%08x' % arg, task_tid(task), waiting.pop(task)[1], ts)
+            held[arg] = (task, ts)
+        elif event == MUTEX_GIVE:
+            if arg in held:
+                holder, began = held.pop(arg)
+                slice(tids[task_tid(holder)], mutex_tid(arg), began, ts)
+        elif event == NOTIFY:
+            target = task_tid(arg)
+            instant('notify %s' % tids[target], tid, ts)
+            flow_id += 1
+            flows.setdefault(target, []).append(flow_id)
+            events.append({'name': 'notify', 'cat': 'notify', 'ph': 's', 'id': flow_id, 'pid': PID, 'tid': tid, 'ts': ts})
+        elif event == SLEEP:
+            slice('stop2', tid, ts - arg * 1000, ts, {'ms': arg})
+        elif event in INSTANTS:
+            args = {'arg': arg}
+            if event == RX_COMPLETE:
+                args = {'bytes': arg}
+            elif event == RX_NOTIFY:
+                args = {'overrun': bool(arg & 0x80000000), 'error': arg & 0x7fffffff}
+            elif event in (QUEUE_BLOCK, QUEUE_RECEIVE, QUEUE_SEND):
+                args = {'queue': '0x%08x' % arg}
+            instant(INSTANTS[event], tid, ts, args)
+        else:
+            instant('event %d' % event, tid, ts, {'arg': arg})
+
+    # Close whatever was still open when the dump was taken
+    if running is not None:
+        slice(tids[running[0]], running[0], running[1], ts)
+    for mutex, (holder, began) in held.items():
+        slice(tids[task_tid(holder)], mutex_tid(mutex), began, ts, {'held at dump': True})
+
+    for tid, name in tids.items():
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': tid, 'args': {'name': name}})
+    events.append({'name': 'process_name', 'ph': 'M', 'pid': PID, 'args': {'name': 'cygnet'}})
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a ktrace dump to Chrome trace JSON')
+    parser.add_argument('capture', nargs='?', help='captured debug output (default stdin)')
+    parser.add_argument('-o', '--output', help='output file (default stdout)')
+    args = parser.parse_args()
+
+    data = open(args.capture, 'rb').read() if args.capture else sys.stdin.buffer.read()
+    dump = parse_capture(data.decode('latin-1').splitlines())
+    if dump is None:
+        sys.exit('no complete ktrace dump found')
+
+    events = convert(*dump)
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, out)
+    out.write('\n')
+
+
+if __name__ == '__main__':
+    main()
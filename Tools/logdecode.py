@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Copyright 2024 Blues Inc.  All rights reserved.
+# Use of this source code is governed by licenses granted by the
+# copyright holder including that found in the LICENSE file.
+
+# Decode debug output captured while "trace binary" is enabled, recovering the text of each
+# binary record from the format strings in the firmware image (the .bin that was flashed).
+# Text output is passed through unchanged.  See debugEncode() in System/Global/debug.c.
+#
+#   logdecode.py cygnet.bin capture.log
+#   cat /dev/ttyACM0 | logdecode.py --timestamps cygnet.bin
+
+import argparse
+import re
+import struct
+import sys
+
+MARKER = 0x00
+
+CONVERSION = re.compile(rb'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t)?([diuxXocfFeEgGps%])')
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def format_string(image, offset):
+    end = image.index(b'\0', offset)
+    return image[offset:end]
+
+
+def decode_record(image, payload):
+    offset, pos = varint(payload, 0)
+    delta_ms, pos = varint(payload, pos)
+    fmt = format_string(image, offset)
+    out = []
+    last = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()].decode('latin-1'))
+        last = m.end()
+        flags, width, precision, _, conv = [g.decode() if g is not None else None for g in m.groups()]
+        if conv == '%':
+            out.append('%')
+            continue
+        if width == '*':
+            v, pos = varint(payload, pos)
+            width = str(zigzag(v))
+        if precision == '*':
+            v, pos = varint(payload, pos)
+            precision = str(zigzag(v)) if zigzag(v) >= 0 else None
+        spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '')
+        if conv == 's':
+            n, pos = varint(payload, pos)
+            value = payload[pos:pos+n].decode('latin-1')
+            pos += n
+        elif conv in 'fFeEgG':
+            value = struct.unpack_from('<d', payload, pos)[0]
+            pos += 8
+        else:
+            value, pos = varint(payload, pos)
+            if conv in 'di':
+                value = zigzag(value)
+        if conv == 'p':
+            spec, conv = spec + '#', 'x'
+        out.append((spec + conv) % value)
+    out.append(fmt[last:].decode('latin-1'))
+    return delta_ms, ''.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary debug output')
+    parser.add_argument('image', help='firmware image (.bin) that was flashed')
+    parser.add_argument('capture', nargs='?', help='captured output (default stdin)')
+    parser.add_argument('--timestamps', action='store_true', help='prefix records with ms since the first')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    data = open(args.capture, 'rb').read() if args.capture else sys.stdin.buffer.read()
+
+    out = sys.stdout
+    pos = 0
+    ms = None
+    while pos < len(data):
+        marker = data.find(bytes([MARKER]), pos)
+        if marker < 0:
+            marker = len(data)
+        out.write(data[pos:marker].decode('latin-1'))
+        if marker + 1 >= len(data):
+            break
+        length = data[marker+1]
+        payload = data[marker+2:marker+2+length]
+        pos = marker + 2 + length
+        try:
+            delta_ms, text = decode_record(image, payload)
+        except (IndexError, ValueError, TypeError, struct.error):
+            out.write('<undecodable record>\n')
+            continue
+        ms = 0 if ms is None else ms + delta_ms
+        if args.timestamps:
+            text = '%10.3f %s' % (ms / 1000, text)
+        out.write(text)
+
+
+if __name__ == '__main__':
+    main()